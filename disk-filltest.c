@@ -29,28 +29,121 @@
 
 #define VERSION "0.8.2"
 
+#if defined(__linux__)
+  /* enable POSIX and Linux extensions even when compiling with -ansi */
+  #define _GNU_SOURCE 1
+#endif
+
 #include <errno.h>
 #include <fcntl.h>
 #include <getopt.h>
 #include <inttypes.h>
 #include <limits.h>
+#include <math.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <sys/time.h>
 #include <time.h>
 #include <unistd.h>
 
 #if defined(_MSC_VER) || defined(__MINGW32__)
   /* no <sys/statvfs.h> */
+  struct iovec { void* iov_base; size_t iov_len; };
 #else
+  #include <sys/uio.h>
+  #define HAVE_PREADV 1
   #include <sys/statvfs.h>
   #define HAVE_STATVFS 1
+  #include <sys/mman.h>
+  #define HAVE_SHM 1
+  #define HAVE_MMAP 1
+  #define HAVE_SIGACTION 1
+  #include <sys/resource.h>
+  #define HAVE_GETRUSAGE 1
+  #define HAVE_POSIX_MEMALIGN 1
+  #define HAVE_FSYNC 1
+  #include <syslog.h>
+  #define HAVE_SYSLOG 1
+  #include <sys/wait.h>
+  #define HAVE_FORK 1
+#endif
+
+#if !defined(_MSC_VER)
+  #include <pthread.h>
+  #define HAVE_PTHREAD 1
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+  #define HAVE_RDTSC 1
+#endif
+
+#if defined(__linux__)
+  /* major() and minor() of device numbers, block devices in /sys */
+  #include <sys/sysmacros.h>
+  #define HAVE_SYSFS 1
+  /* CPU affinity and mbind() without depending on libnuma */
+  #include <sched.h>
+  #include <sys/syscall.h>
+  #define HAVE_NUMA 1
+  #ifndef MPOL_PREFERRED
+    #define MPOL_PREFERRED 1
+  #endif
+  /* native AIO through raw system calls without depending on libaio */
+  #include <linux/aio_abi.h>
+  #define HAVE_AIO 1
+  #define HAVE_SYNC_FILE_RANGE 1
+  /* preadv2() and pwritev2() with per-call flags since glibc 2.26 */
+  #if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 26)
+    #define HAVE_PREADV2 1
+    /* uncached buffered I/O, since Linux 6.14 */
+    #ifndef RWF_DONTCACHE
+      #define RWF_DONTCACHE 0x00000080
+    #endif
+  #endif
+  /* extent maps of files */
+  #include <sys/ioctl.h>
+  #include <linux/fs.h>
+  #include <linux/fiemap.h>
+  #define HAVE_FIEMAP 1
+#endif
+
+/* USDT static tracepoints for bpftrace, perf and systemtap, enabled if
+ * <sys/sdt.h> is available unless compiled with -DHAVE_SDT=0. The probes are
+ * single nop instructions and cost nothing unless a tracer attaches. */
+#ifndef HAVE_SDT
+  #if defined(__has_include)
+    #if __has_include(<sys/sdt.h>)
+      #define HAVE_SDT 1
+    #endif
+  #endif
+#endif
+
+#if HAVE_SDT
+  #include <sys/sdt.h>
+  #define PROBE2(name, a1, a2) \
+    DTRACE_PROBE2(disk_filltest, name, a1, a2)
+  #define PROBE3(name, a1, a2, a3) \
+    DTRACE_PROBE3(disk_filltest, name, a1, a2, a3)
+  #define PROBE4(name, a1, a2, a3, a4) \
+    DTRACE_PROBE4(disk_filltest, name, a1, a2, a3, a4)
+  #define PROBE5(name, a1, a2, a3, a4, a5) \
+    DTRACE_PROBE5(disk_filltest, name, a1, a2, a3, a4, a5)
+#else
+  #define PROBE2(name, a1, a2) do { } while (0)
+  #define PROBE3(name, a1, a2, a3) do { } while (0)
+  #define PROBE4(name, a1, a2, a3, a4) do { } while (0)
+  #define PROBE5(name, a1, a2, a3, a4, a5) do { } while (0)
 #endif
 
 /* random seed used */
 unsigned int g_seed;
 
+/* seed was given with -s */
+int g_seed_given = 0;
+
 /* only perform read operation */
 int gopt_readonly = 0;
 
@@ -72,9 +165,60 @@ unsigned int gopt_file_limit = UINT_MAX;
 /* number of repetitions */
 int gopt_repeat = 1;
 
+/* age the volume before the run: percentage of the aging files deleted
+ * again (0 = off) and bytes of aging files (0 = all free space) */
+unsigned int gopt_age = 0;
+uint64_t gopt_age_bytes = 0;
+
+/* verify the files this many times from the device, 0 = off */
+unsigned int gopt_reread = 0;
+
+/* scrub the retained files at this rate in MiB/s until interrupted (0 = off),
+ * remembering the position in a checkpoint file, and run an alert command on
+ * failed blocks */
+double gopt_scrub = 0;
+const char* gopt_scrub_checkpoint = "disk-filltest.scrub";
+const char* gopt_scrub_alert = NULL;
+
 /* size of last file written */
 unsigned int g_last_filesize = UINT_MAX;
 
+/* set if a write failed for another reason than a full disk */
+int g_write_failed = 0;
+
+/* name of shared memory segment to publish live statistics in */
+const char* gopt_stats_shm = NULL;
+
+/* interval of intra-file progress reports in seconds, 0 = off, < 0 = auto */
+double gopt_progress = -1;
+
+/* run end-to-end benchmark against in-memory and tmpfs backends */
+int gopt_bench_e2e = 0;
+
+/* open files with O_DIRECT, bypassing the page cache */
+int gopt_direct = 0;
+
+/* uncached buffered I/O: transfer through the page cache with RWF_DONTCACHE,
+ * which drops the pages afterwards */
+int gopt_dontcache = 0;
+
+/* run the benchmark in each I/O mode and compare them */
+int gopt_io_compare = 0;
+
+/* write back and evict each file from the page cache after writing it */
+int gopt_evict = 0;
+
+/* start write-back of windows of this size behind the write position and
+ * wait for the window before, 0 = off */
+uint64_t gopt_writeback_window = 0;
+
+/* verify by mapping the files instead of reading them */
+int gopt_mmap = 0;
+
+/* number of measured trials and warm-up runs of the benchmark mode */
+unsigned int gopt_bench_trials = 0;
+unsigned int gopt_bench_warmup = 1;
+
 /* return the current timestamp */
 double timestamp(void)
 {
@@ -85,431 +229,7315 @@ double timestamp(void)
 
 /* simple linear congruential random generator, faster than rand() and totally
  * sufficient for this cause. */
+#define LCG_MUL 0x27BB2EE687B0B0FDLLU
+#define LCG_ADD 0xB504F32DLU
+
 uint64_t lcg_random(uint64_t *xn)
 {
-    *xn = 0x27BB2EE687B0B0FDLLU * *xn + 0xB504F32DLU;
+    *xn = LCG_MUL * *xn + LCG_ADD;
     return *xn;
 }
 
+/* calculate multiplier and increment which advance the generator by n steps
+ * at once, by squaring the affine map x -> mul * x + add. */
+void lcg_power(uint64_t n, uint64_t* mul, uint64_t* add)
+{
+    uint64_t m = LCG_MUL, a = LCG_ADD;
+
+    *mul = 1, *add = 0;
+    while (n != 0) {
+        if (n & 1) {
+            *mul = m * *mul;
+            *add = m * *add + a;
+        }
+        a = m * a + a;
+        m = m * m;
+        n >>= 1;
+    }
+}
+
+/* advance the generator by n steps in O(log n) time */
+void lcg_skip(uint64_t* xn, uint64_t n)
+{
+    uint64_t mul, add;
+    lcg_power(n, &mul, &add);
+    *xn = mul * *xn + add;
+}
+
 /* item type used in blocks written to disk */
 typedef uint64_t item_type;
 
-/* a list of open file handles */
-int* g_filehandle = NULL;
-unsigned int g_filehandle_size = 0;
-unsigned int g_filehandle_limit = 0;
+/* alignment of I/O buffers and request sizes, sufficient for O_DIRECT on
+ * common devices */
+#define BLOCK_ALIGN 4096
 
-/* append to the list of open file handles */
-void filehandle_append(int fd)
+/* buffer of expected data of one block, aligned to BLOCK_ALIGN */
+item_type* g_expect;
+
+/* allocate a buffer aligned for direct I/O */
+void* buffer_alloc(size_t size)
 {
-    if (g_filehandle_size >= g_filehandle_limit)
-    {
-        int* new_filehandle;
+    void* ptr;
+#if HAVE_POSIX_MEMALIGN
+    if (posix_memalign(&ptr, BLOCK_ALIGN, size) != 0)
+        ptr = NULL;
+#else
+    ptr = malloc(size);
+#endif
+    if (ptr == NULL) {
+        printf("Out of memory for I/O buffers.\n");
+        exit(EXIT_FAILURE);
+    }
+    return ptr;
+}
 
-        g_filehandle_limit *= 2;
-        if (g_filehandle_limit < 128) g_filehandle_limit = 128;
+/* fill a block with the next items of the random sequence, one item at a
+ * time. This is the reference implementation. */
+void fill_random_block_lcg(item_type* block, size_t items, uint64_t* rnd)
+{
+    size_t i;
+    for (i = 0; i < items; ++i)
+        block[i] = lcg_random(rnd);
+}
 
-        new_filehandle = realloc(
-            g_filehandle, sizeof(int) * g_filehandle_limit);
-        if (!new_filehandle) {
-            fprintf(stderr,
-                    "Out of memory when allocating new file handle buffer.\n");
-            exit(EXIT_FAILURE);
+/* fill a block with the next items of the random sequence. The sequence is
+ * generated as four interleaved streams which each advance by four steps,
+ * which breaks the multiply dependency chain and lets the compiler vectorize,
+ * while producing exactly the same items as fill_random_block_lcg(). */
+void fill_random_block(item_type* block, size_t items, uint64_t* rnd)
+{
+    uint64_t mul4, add4, s0, s1, s2, s3;
+    size_t i = 0, n4 = items & ~(size_t)3;
+
+    if (n4 >= 8) {
+        lcg_power(4, &mul4, &add4);
+
+        s0 = lcg_random(rnd);
+        s1 = lcg_random(rnd);
+        s2 = lcg_random(rnd);
+        s3 = lcg_random(rnd);
+
+        for ( ; i < n4; i += 4) {
+            block[i + 0] = s0;
+            block[i + 1] = s1;
+            block[i + 2] = s2;
+            block[i + 3] = s3;
+            s0 = mul4 * s0 + add4;
+            s1 = mul4 * s1 + add4;
+            s2 = mul4 * s2 + add4;
+            s3 = mul4 * s3 + add4;
         }
-        g_filehandle = new_filehandle;
+
+        /* continue sequence after the last item stored */
+        *rnd = block[n4 - 1];
     }
 
-    g_filehandle[ g_filehandle_size++ ] = fd;
+    for ( ; i < items; ++i)
+        block[i] = lcg_random(rnd);
 }
 
-/* produce nicely formatted time in seconds */
-void format_time(unsigned int sec, char output[64])
+/* compare a block read against the expected items one by one, returns the
+ * index of the first mismatching item or items if the blocks are equal. This
+ * is the reference implementation. */
+size_t compare_block_loop(const item_type* block, const item_type* expect,
+                          size_t items)
 {
-    /* maximum digits of 32-bit unsigned int are 9. */
-    if (sec >= 24 * 3600) {
-        unsigned int days = sec / (24 * 3600);
-        sec -= days * (24 * 3600);
-        unsigned int hours = sec / 3600;
-        sec -= hours * 3600;
-        unsigned int minutes = sec / 60;
-        sec -= minutes * 60;
-        sprintf(output, "%ud%uh%um%us", days, hours, minutes, sec);
-    }
-    else if (sec >= 3600) {
-        unsigned int hours = sec / 3600;
-        sec -= hours * 3600;
-        unsigned int minutes = sec / 60;
-        sec -= minutes * 60;
-        sprintf(output, "%uh%um%us", hours, minutes, sec);
-    }
-    else if (sec >= 60) {
-        unsigned int minutes = sec / 60;
-        sec -= minutes * 60;
-        sprintf(output, "%um%us", minutes, sec);
-    }
-    else {
-        sprintf(output, "%us", sec);
+    size_t i;
+    for (i = 0; i < items; ++i) {
+        if (block[i] != expect[i])
+            return i;
     }
+    return items;
 }
 
-/* for compatibility with windows, use O_BINARY if available */
-#ifndef O_BINARY
-#define O_BINARY 0
-#endif
-
-/* print command line usage */
-void print_usage(char* argv[])
+/* compare a block read against the expected items, returns the index of the
+ * first mismatching item or items if the blocks are equal. memcmp() is
+ * vectorized by the C library, only a mismatch is located item by item. */
+size_t compare_block(const item_type* block, const item_type* expect,
+                     size_t items)
 {
-    fprintf(stderr,
-            "Usage: %s [-s seed] [-f files] [-S size] [-r] [-u] [-U] [-C dir]\n"
-            "\n"
-            "disk-filltest " VERSION " is a simple program which fills a path with random\n"
-            "data and then rereads the files to check that the random sequence was\n"
-            "correctly stored.\n"
-            "\n"
-            "Options: \n"
-            "  -C <dir>          Change into given directory before starting work.\n"
-            "  -f <file number>  Only write this number of 1 GiB sized files.\n"
-            "  -N                Skip verification, e.g. for just wiping a disk.\n"
-            "  -r                Only verify existing data files with given random seed.\n"
-            "  -R <times>        Repeat fill/test/wipe steps given number of times.\n"
-            "  -s <random seed>  Use random seed to write or verify data files.\n"
-            "  -S <size>         Size of each random file in MiB (default: 1024).\n"
-            "  -u                Remove files after successful test.\n"
-            "  -U                Immediately remove files, write and verify via file handles.\n"
-            "  -V                Print version and exit.\n"
-            "\n",
-            argv[0]);
-    exit(EXIT_FAILURE);
+    if (memcmp(block, expect, items * sizeof(item_type)) == 0)
+        return items;
+    return compare_block_loop(block, expect, items);
 }
 
-/* parse command line parameters */
-void parse_commandline(int argc, char* argv[])
+/* verify a block against the random sequence without an expected buffer, by
+ * generating and comparing small chunks which stay in the L1 cache. Returns
+ * the index of the first mismatch or items. */
+size_t verify_random_block(const item_type* block, size_t items, uint64_t* rnd)
 {
-    int opt;
+    item_type expect[512];
+    size_t i, n, r;
 
-    while ((opt = getopt(argc, argv, "hs:S:f:ruUC:NR:V")) != -1) {
-        switch (opt) {
-        case 's':
-            g_seed = atoi(optarg);
-            break;
-        case 'S':
-            gopt_file_size = atoi(optarg);
-            break;
-        case 'f':
-            gopt_file_limit = atoi(optarg);
-            break;
-        case 'r':
-            gopt_readonly = 1;
-            break;
-        case 'u':
-            gopt_unlink_after = 1;
-            break;
-        case 'U':
-            gopt_unlink_immediate = 1;
-            break;
-        case 'C':
-            if (chdir(optarg) != 0) {
-                printf("Error chdir to %s: %s\n", optarg, strerror(errno));
-                exit(EXIT_FAILURE);
-            }
-            break;
-        case 'N':
-            gopt_skip_verify = 1;
-            break;
-        case 'R':
-            gopt_repeat = atoi(optarg);
-            break;
-	case 'V':
-	    printf("disk-filltest " VERSION "\n");
-            exit(EXIT_SUCCESS);
-        case 'h':
-        default:
-            print_usage(argv);
-        }
+    for (i = 0; i < items; i += n) {
+        n = items - i < 512 ? items - i : 512;
+        fill_random_block(expect, n, rnd);
+        r = compare_block(block + i, expect, n);
+        if (r != n)
+            return i + r;
     }
+    return items;
+}
 
-    if (optind < argc)
-        print_usage(argv);
+/******************************************************************************/
+/* Accounting of wall time and CPU cycles spent in the stages of each phase:
+ * generating the random sequence, blocking in I/O system calls and comparing
+ * verified data. Together with getrusage() deltas this shows whether the tool
+ * itself or the disk limits throughput. */
 
-    if (gopt_file_size == 0)
-        gopt_file_size = 1024;
+enum cost_stage { STAGE_GENERATE = 0, STAGE_IO, STAGE_COMPARE, STAGE_COUNT };
+
+struct phase_cost {
+    double wall[STAGE_COUNT];      /* seconds spent in each stage */
+    uint64_t cycles[STAGE_COUNT];  /* cycles spent in each stage */
+    double start;                  /* timestamp() of phase start */
+#if HAVE_GETRUSAGE
+    struct rusage ru_start;        /* resource usage at phase start */
+#endif
+};
+
+/* a point in time for chained stage measurements */
+struct cost_mark {
+    double wall;
+    uint64_t cycles;
+};
+
+/* return the CPU time stamp counter, or nanoseconds where there is none */
+uint64_t cycle_counter(void)
+{
+#if HAVE_RDTSC
+    return __builtin_ia32_rdtsc();
+#else
+    return (uint64_t)(timestamp() * 1e9);
+#endif
 }
 
-/* unlink old random files */
-void unlink_randfiles(void)
+/* start accounting a phase */
+void cost_start(struct phase_cost* c)
 {
-    unsigned int filenum = 0;
+    memset(c, 0, sizeof(*c));
+    c->start = timestamp();
+#if HAVE_GETRUSAGE
+    getrusage(RUSAGE_SELF, &c->ru_start);
+#endif
+}
 
-    while (filenum < UINT_MAX)
-    {
-        char filename[32];
-        sprintf(filename, "random-%08u", filenum);
+/* set a mark to measure the next stage from */
+void cost_mark(struct cost_mark* m)
+{
+    m->wall = timestamp();
+    m->cycles = cycle_counter();
+}
 
-        if (unlink(filename) != 0)
-            break;
+/* account the time since the mark to a stage, and move the mark to now */
+void cost_add(struct phase_cost* c, enum cost_stage stage, struct cost_mark* m)
+{
+    struct cost_mark now;
+    cost_mark(&now);
+    c->wall[stage] += now.wall - m->wall;
+    c->cycles[stage] += now.cycles - m->cycles;
+    *m = now;
+}
 
-        if (filenum == 0)
-            printf("Removing old files .");
-        else
-            printf(".");
-        fflush(stdout);
+#if HAVE_GETRUSAGE
+/* difference of two timevals in seconds */
+double timeval_diff(const struct timeval* a, const struct timeval* b)
+{
+    return (double)(a->tv_sec - b->tv_sec)
+        + (double)(a->tv_usec - b->tv_usec) / 1e6;
+}
+#endif
 
-        ++filenum;
-    }
+/* results of the last write and verify phases */
+struct phase_result {
+    uint64_t bytes;          /* bytes processed */
+    double seconds;          /* duration of phase */
+    struct phase_cost cost;  /* cost breakdown */
+};
 
-    if (filenum > 0)
-        printf(" total: %u.\n", filenum);
-}
+struct phase_result g_phase_result[2];
 
-/* fill disk */
-void write_randfiles(void)
+/* save results of a finished phase */
+void phase_result_save(int dir, const struct phase_cost* c,
+                       uint64_t bytes)
 {
-    unsigned int filenum = 0;
-    int done = 0;
-    unsigned int expected_file_limit = UINT_MAX;
+    g_phase_result[dir].bytes = bytes;
+    g_phase_result[dir].seconds = timestamp() - c->start;
+    g_phase_result[dir].cost = *c;
+}
 
-    if (gopt_file_limit == UINT_MAX) {
-#if HAVE_STATVFS
-        struct statvfs buf;
+/* print the cost breakdown of a phase which processed the given bytes */
+void cost_report(const char* phase, const struct phase_cost* c, uint64_t bytes)
+{
+    static const char* stage_name[STAGE_COUNT] = {
+        "generate", "I/O syscalls", "compare"
+    };
+#if HAVE_RDTSC
+    const char* unit = "cycles";
+#else
+    const char* unit = "ns";
+#endif
+    double elapsed = timestamp() - c->start, other = elapsed;
+    int s;
 
-        if (statvfs(".", &buf) == 0) {
-            uint64_t free_size =
-                (uint64_t)(buf.f_blocks) * (uint64_t)(buf.f_bsize);
+    if (bytes == 0) bytes = 1;
 
-            expected_file_limit = (free_size + gopt_file_size - 1)
-                / (1024 * 1024) / gopt_file_size;
-        }
-#endif /* HAVE_STATVFS */
+    printf("%s phase cost:", phase);
+    for (s = 0; s < STAGE_COUNT; ++s) {
+        if (c->cycles[s] == 0) continue;
+        printf(" %s %.2f s (%.2f %s/byte),", stage_name[s], c->wall[s],
+               (double)c->cycles[s] / bytes, unit);
+        other -= c->wall[s];
     }
-    else {
-        expected_file_limit = gopt_file_limit;
+    printf(" other %.2f s.\n", other > 0 ? other : 0);
+
+#if HAVE_GETRUSAGE
+    {
+        struct rusage ru;
+        getrusage(RUSAGE_SELF, &ru);
+        printf("%s phase resources: user %.2f s, system %.2f s, "
+               "%ld voluntary and %ld involuntary context switches.\n",
+               phase,
+               timeval_diff(&ru.ru_utime, &c->ru_start.ru_utime),
+               timeval_diff(&ru.ru_stime, &c->ru_start.ru_stime),
+               ru.ru_nvcsw - c->ru_start.ru_nvcsw,
+               ru.ru_nivcsw - c->ru_start.ru_nivcsw);
     }
+#endif
+    fflush(stdout);
+}
 
-    printf("Writing files random-######## with seed %u\n", g_seed);
+/******************************************************************************/
+/* Micro-benchmarks of the generator and compare kernels, independent of any
+ * disk, over several buffer sizes and thread counts. */
 
-    while (!done && filenum < gopt_file_limit)
-    {
-        char filename[32], eta[64];
-        int fd;
-        ssize_t wb;
-        unsigned int i, blocknum, wp;
-        uint64_t wtotal;
-        double ts1, ts2, speed;
-        uint64_t rnd;
+/* duration of each benchmark run in seconds */
+#define BENCH_SECONDS 0.25
 
-        item_type block[(1024 * 1024) / sizeof(item_type)];
+/* a kernel: processes items in buf (and expect) starting at the given seed */
+struct bench_kernel {
+    const char* name;
+    size_t (*run)(item_type* buf, item_type* expect, size_t items,
+                  uint64_t seed);
+};
 
-        sprintf(filename, "random-%08u", filenum);
+size_t bench_generate_lcg(item_type* buf, item_type* expect, size_t items,
+                          uint64_t seed)
+{
+    (void)expect;
+    fill_random_block_lcg(buf, items, &seed);
+    return (size_t)seed;
+}
 
-        fd = open(filename, O_RDWR | O_CREAT | O_TRUNC | O_BINARY, 0600);
-        if (fd < 0) {
-            printf("Error opening next file %s: %s\n",
-                   filename, strerror(errno));
-            break;
-        }
+size_t bench_generate(item_type* buf, item_type* expect, size_t items,
+                      uint64_t seed)
+{
+    (void)expect;
+    fill_random_block(buf, items, &seed);
+    return (size_t)seed;
+}
 
-        if (gopt_unlink_immediate) {
-            if (unlink(filename) != 0) {
-                printf("Error unlinking opened file %s: %s\n",
-                       filename, strerror(errno));
-            }
-        }
+size_t bench_compare_loop(item_type* buf, item_type* expect, size_t items,
+                          uint64_t seed)
+{
+    (void)seed;
+    return compare_block_loop(buf, expect, items);
+}
 
-        /* reset random generator for each 1 GiB file */
-        rnd = g_seed + (++filenum);
+size_t bench_compare(item_type* buf, item_type* expect, size_t items,
+                     uint64_t seed)
+{
+    (void)seed;
+    return compare_block(buf, expect, items);
+}
 
-        wtotal = 0;
-        ts1 = timestamp();
+size_t bench_verify_split(item_type* buf, item_type* expect, size_t items,
+                          uint64_t seed)
+{
+    fill_random_block(expect, items, &seed);
+    return compare_block(buf, expect, items);
+}
 
-        for (blocknum = 0; blocknum < gopt_file_size; ++blocknum)
-        {
-            for (i = 0; i < sizeof(block) / sizeof(item_type); ++i)
-                block[i] = lcg_random(&rnd);
+size_t bench_verify_fused(item_type* buf, item_type* expect, size_t items,
+                          uint64_t seed)
+{
+    (void)expect;
+    return verify_random_block(buf, items, &seed);
+}
 
-            wp = 0;
+const struct bench_kernel g_bench_kernels[] = {
+    { "generate lcg", bench_generate_lcg },
+    { "generate lcg x4", bench_generate },
+    { "compare loop", bench_compare_loop },
+    { "compare memcmp", bench_compare },
+    { "verify gen+cmp", bench_verify_split },
+    { "verify fused", bench_verify_fused },
+    { NULL, NULL }
+};
 
-            while ( wp != sizeof(block) && !done )
+/* state and result of one benchmark thread */
+struct bench_thread {
+    const struct bench_kernel* kernel;
+    size_t bytes;             /* buffer size */
+    volatile int* go;         /* start flag set by main thread */
+    uint64_t bytes_done;      /* bytes processed */
+    uint64_t cycles;          /* cycles spent */
+    double wall;              /* seconds spent */
+    size_t sink;              /* results, to keep kernels from being elided */
+#if HAVE_PTHREAD
+    pthread_t thread;
+#endif
+};
+
+/* run one kernel on private buffers for BENCH_SECONDS */
+void* bench_thread_run(void* arg)
+{
+    struct bench_thread* bt = (struct bench_thread*)arg;
+    size_t items = bt->bytes / sizeof(item_type);
+    size_t iter, batch = (1024 * 1024) / bt->bytes + 1;
+    item_type* buf = (item_type*)malloc(bt->bytes);
+    item_type* expect = (item_type*)malloc(bt->bytes);
+    uint64_t rnd = 42, c1;
+    double t1, t2;
+
+    if (!buf || !expect) {
+        fprintf(stderr, "Out of memory allocating benchmark buffers.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    /* both buffers contain the sequence of seed 42, such that compares run
+     * over the full buffer */
+    fill_random_block_lcg(buf, items, &rnd);
+    memcpy(expect, buf, bt->bytes);
+
+    while (!__atomic_load_n(bt->go, __ATOMIC_ACQUIRE)) { }
+
+    t1 = t2 = timestamp();
+    c1 = cycle_counter();
+    while (t2 - t1 < BENCH_SECONDS)
+    {
+        for (iter = 0; iter < batch; ++iter)
+            bt->sink += bt->kernel->run(buf, expect, items, 42);
+        bt->bytes_done += batch * bt->bytes;
+        t2 = timestamp();
+    }
+    bt->cycles = cycle_counter() - c1;
+    bt->wall = t2 - t1;
+
+    free(buf);
+    free(expect);
+    return NULL;
+}
+
+/* run one kernel with given buffer size and thread count, print results */
+void bench_kernel(const struct bench_kernel* k, size_t bytes,
+                  unsigned int threads)
+{
+    struct bench_thread* bt;
+    volatile int go = 0;
+    uint64_t total = 0, cycles = 0;
+    double wall = 0;
+    unsigned int t;
+
+    bt = (struct bench_thread*)calloc(threads, sizeof(struct bench_thread));
+    if (!bt) {
+        fprintf(stderr, "Out of memory allocating benchmark threads.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (t = 0; t < threads; ++t) {
+        bt[t].kernel = k;
+        bt[t].bytes = bytes;
+        bt[t].go = &go;
+#if HAVE_PTHREAD
+        if (pthread_create(&bt[t].thread, NULL, bench_thread_run, &bt[t])) {
+            fprintf(stderr, "Error creating benchmark thread.\n");
+            exit(EXIT_FAILURE);
+        }
+#endif
+    }
+
+    __atomic_store_n(&go, 1, __ATOMIC_RELEASE);
+#if !HAVE_PTHREAD
+    bench_thread_run(&bt[0]);
+#endif
+
+    for (t = 0; t < threads; ++t) {
+#if HAVE_PTHREAD
+        pthread_join(bt[t].thread, NULL);
+#endif
+        total += bt[t].bytes_done;
+        cycles += bt[t].cycles;
+        if (bt[t].wall > wall) wall = bt[t].wall;
+    }
+
+    printf("%-16s %7"PRIu64" KiB %7u %9.2f %12.3f\n",
+           k->name, (uint64_t)bytes / 1024, threads,
+           total / wall / 1e9, (double)cycles / total);
+    fflush(stdout);
+
+    free(bt);
+}
+
+/* check that all generator kernels produce the reference sequence and that
+ * the compare kernels find the first mismatch */
+void bench_check_kernels(void)
+{
+    item_type a[1000], b[1000];
+    uint64_t r1 = 12345, r2 = 12345;
+    size_t n;
+
+    for (n = 0; n < 1000; n += 123) {
+        fill_random_block_lcg(a, n, &r1);
+        fill_random_block(b, n, &r2);
+        if (memcmp(a, b, n * sizeof(item_type)) != 0 || r1 != r2) {
+            printf("Kernel self-check failed: generators differ.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    r1 = 777;
+    fill_random_block_lcg(a, 1000, &r1);
+    memcpy(b, a, sizeof(b));
+    b[765] ^= 1;
+    r1 = 777;
+    if (compare_block(b, a, 1000) != 765 ||
+        compare_block_loop(b, a, 1000) != 765 ||
+        verify_random_block(b, 1000, &r1) != 765) {
+        printf("Kernel self-check failed: compare kernels.\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* run all kernel micro-benchmarks */
+void bench_kernels(void)
+{
+    static const size_t sizes[] = {
+        4 * 1024, 64 * 1024, 1024 * 1024, 16 * 1024 * 1024, 0
+    };
+    unsigned int nproc = 1, threads;
+    const struct bench_kernel* k;
+    const size_t* s;
+
+#if HAVE_PTHREAD && defined(_SC_NPROCESSORS_ONLN)
+    nproc = (unsigned int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (nproc < 1) nproc = 1;
+#endif
+
+    bench_check_kernels();
+
+    printf("Kernel micro-benchmarks, %.2f s per run, %s per byte per thread\n",
+           BENCH_SECONDS,
+#if HAVE_RDTSC
+           "cycles"
+#else
+           "ns"
+#endif
+        );
+    printf("%-16s %11s %7s %9s %12s\n",
+           "kernel", "buffer", "threads", "GB/s", "cycles/byte");
+
+    for (k = g_bench_kernels; k->name; ++k) {
+        for (s = sizes; *s; ++s) {
+            for (threads = 1; ; threads *= 2) {
+                if (threads > nproc) threads = nproc;
+                bench_kernel(k, *s, threads);
+                if (threads == nproc) break;
+            }
+        }
+    }
+
+    exit(EXIT_SUCCESS);
+}
+
+/******************************************************************************/
+/* Live statistics, optionally published in a POSIX shared memory segment.
+ *
+ * The segment contains one struct filltest_stats, which is protected by a
+ * seqlock: the single writer (the main loop) increments seq to an odd value
+ * before and back to an even value after each update. Readers copy the struct
+ * and retry if seq was odd or changed during the copy. Updating the counters
+ * therefore costs no system calls on the hot path. */
+
+#define STATS_MAGIC 0x4C544644u /* "DFTL" */
+#define STATS_VERSION 1
+#define STATS_HIST_BUCKETS 32
+
+enum stats_phase {
+    PHASE_IDLE = 0, PHASE_UNLINK, PHASE_WRITE, PHASE_VERIFY, PHASE_DONE
+};
+
+enum stats_dir { DIR_WRITE = 0, DIR_READ = 1 };
+
+struct filltest_stats {
+    /* layout identification, checked by readers */
+    uint32_t magic, version, size;
+    /* seqlock counter, odd while an update is in progress */
+    uint32_t seq;
+
+    int32_t pid;
+    uint32_t seed;
+    uint32_t phase;          /* enum stats_phase */
+    uint32_t repeat;         /* current repetition */
+    uint32_t filenum;        /* current file number */
+    uint32_t files_done;     /* files completed in current phase */
+    uint32_t files_expected; /* expected files in current phase or 0 */
+    uint32_t inflight;       /* I/O requests submitted but not completed */
+    uint32_t errors;         /* I/O errors encountered */
+    uint32_t mismatches;     /* verification mismatches */
+
+    uint64_t bytes_written;  /* total bytes written in all phases */
+    uint64_t bytes_read;     /* total bytes verified in all phases */
+    uint64_t phase_bytes;    /* bytes processed in current phase */
+    uint64_t file_bytes;     /* bytes processed in current file */
+
+    double start_time;       /* timestamp() of program start */
+    double phase_start_time; /* timestamp() of current phase start */
+    double update_time;      /* timestamp() of last update */
+
+    /* I/O request latency histograms for writes and reads: bucket 0 counts
+     * latencies below 1 us, bucket i >= 1 those in [2^(i-1), 2^i) us. */
+    uint64_t lat_hist[2][STATS_HIST_BUCKETS];
+    uint64_t lat_count[2];
+    double lat_sum[2];       /* sum of latencies in seconds */
+    double lat_max[2];       /* maximum latency in seconds */
+};
+
+/* private statistics used if no shared memory segment is published */
+struct filltest_stats g_stats_local;
+
+/* current statistics, either g_stats_local or the shared memory segment */
+struct filltest_stats* g_stats = &g_stats_local;
+
+/* name of shared memory segment created, for removal at exit */
+char g_stats_shm_name[64] = "";
+
+/* begin an update of the statistics struct */
+void stats_begin(void)
+{
+    __atomic_store_n(&g_stats->seq, g_stats->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+/* finish an update of the statistics struct */
+void stats_end(void)
+{
+    g_stats->update_time = timestamp();
+    __atomic_store_n(&g_stats->seq, g_stats->seq + 1, __ATOMIC_RELEASE);
+}
+
+/* initialize statistics struct header */
+void stats_init(struct filltest_stats* st)
+{
+    memset(st, 0, sizeof(*st));
+    st->magic = STATS_MAGIC;
+    st->version = STATS_VERSION;
+    st->size = sizeof(*st);
+    st->pid = getpid();
+    st->seed = g_seed;
+    st->start_time = st->phase_start_time = st->update_time = timestamp();
+}
+
+/* switch to a new phase and reset phase counters */
+void stats_phase(enum stats_phase phase, unsigned int files_expected)
+{
+    PROBE2(phase__change, (int)phase, g_stats->repeat);
+
+    stats_begin();
+    g_stats->phase = phase;
+    g_stats->seed = g_seed;
+    g_stats->filenum = 0;
+    g_stats->files_done = 0;
+    g_stats->files_expected = files_expected;
+    g_stats->phase_bytes = 0;
+    g_stats->file_bytes = 0;
+    g_stats->phase_start_time = timestamp();
+    stats_end();
+}
+
+/* return latency histogram bucket of a latency in seconds */
+unsigned int stats_lat_bucket(double latency)
+{
+    uint64_t us = (uint64_t)(latency * 1e6);
+    unsigned int b = 0;
+    while (us != 0 && b < STATS_HIST_BUCKETS - 1) {
+        us >>= 1;
+        ++b;
+    }
+    return b;
+}
+
+/* start processing the given file number in the current phase */
+void stats_file_begin(unsigned int filenum)
+{
+    stats_begin();
+    g_stats->filenum = filenum;
+    g_stats->file_bytes = 0;
+    stats_end();
+}
+
+/* finished processing current file */
+void stats_file_done(void)
+{
+    stats_begin();
+    g_stats->files_done++;
+    stats_end();
+}
+
+/* set number of I/O requests in flight */
+void stats_inflight(unsigned int inflight)
+{
+    stats_begin();
+    g_stats->inflight = inflight;
+    stats_end();
+}
+
+/* count an I/O error or a verification mismatch */
+void stats_error(int mismatch)
+{
+    stats_begin();
+    if (mismatch)
+        g_stats->mismatches++;
+    else
+        g_stats->errors++;
+    stats_end();
+}
+
+/* account a completed I/O request of given size and latency */
+void stats_io_done(enum stats_dir dir, uint64_t bytes, double latency)
+{
+    stats_begin();
+    if (dir == DIR_WRITE)
+        g_stats->bytes_written += bytes;
+    else
+        g_stats->bytes_read += bytes;
+    g_stats->phase_bytes += bytes;
+    g_stats->file_bytes += bytes;
+    g_stats->lat_hist[dir][stats_lat_bucket(latency)]++;
+    g_stats->lat_count[dir]++;
+    g_stats->lat_sum[dir] += latency;
+    if (latency > g_stats->lat_max[dir])
+        g_stats->lat_max[dir] = latency;
+    stats_end();
+}
+
+/* count a batch of requests whose latencies were collected in hist, for
+ * threads which merge their statistics from time to time */
+void stats_io_add(enum stats_dir dir, uint64_t bytes,
+                  const uint64_t hist[STATS_HIST_BUCKETS], uint64_t count,
+                  double sum, double max)
+{
+    unsigned int b;
+
+    stats_begin();
+    if (dir == DIR_WRITE)
+        g_stats->bytes_written += bytes;
+    else
+        g_stats->bytes_read += bytes;
+    g_stats->phase_bytes += bytes;
+    g_stats->file_bytes += bytes;
+    for (b = 0; b < STATS_HIST_BUCKETS; ++b)
+        g_stats->lat_hist[dir][b] += hist[b];
+    g_stats->lat_count[dir] += count;
+    g_stats->lat_sum[dir] += sum;
+    if (max > g_stats->lat_max[dir])
+        g_stats->lat_max[dir] = max;
+    stats_end();
+}
+
+/* estimate a latency percentile in seconds from a histogram by returning the
+ * upper bound of the bucket containing it */
+double stats_lat_percentile(const uint64_t hist[STATS_HIST_BUCKETS],
+                            uint64_t count, double pct)
+{
+    uint64_t rank = (uint64_t)(count * pct / 100.0), sum = 0;
+    unsigned int b;
+
+    if (count == 0) return 0;
+    for (b = 0; b < STATS_HIST_BUCKETS; ++b) {
+        sum += hist[b];
+        if (sum > rank) break;
+    }
+    return (double)((uint64_t)1 << b) / 1e6;
+}
+
+/* remove shared memory segment at exit */
+void stats_shm_remove(void)
+{
+#if HAVE_SHM
+    if (g_stats_shm_name[0])
+        shm_unlink(g_stats_shm_name);
+#endif
+}
+
+/* create shared memory segment and switch g_stats to it */
+void stats_shm_create(const char* name)
+{
+#if HAVE_SHM
+    int fd;
+    void* addr;
+
+    if (name[0] == 0)
+        snprintf(g_stats_shm_name, sizeof(g_stats_shm_name),
+                 "/disk-filltest.%d", (int)getpid());
+    else if (name[0] != '/')
+        snprintf(g_stats_shm_name, sizeof(g_stats_shm_name), "/%s", name);
+    else
+        snprintf(g_stats_shm_name, sizeof(g_stats_shm_name), "%s", name);
+
+    /* never take over the segment of another running instance */
+    fd = shm_open(g_stats_shm_name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0 && errno == EEXIST) {
+        printf("Shared memory segment %s already exists, it may belong to "
+               "another running instance. Choose another name or remove "
+               "/dev/shm%s if it is stale.\n",
+               g_stats_shm_name, g_stats_shm_name);
+        exit(EXIT_FAILURE);
+    }
+    if (fd < 0) {
+        printf("Error creating shared memory segment %s: %s\n",
+               g_stats_shm_name, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    if (ftruncate(fd, sizeof(struct filltest_stats)) != 0) {
+        printf("Error resizing shared memory segment %s: %s\n",
+               g_stats_shm_name, strerror(errno));
+        shm_unlink(g_stats_shm_name);
+        exit(EXIT_FAILURE);
+    }
+    addr = mmap(NULL, sizeof(struct filltest_stats),
+                PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        printf("Error mapping shared memory segment %s: %s\n",
+               g_stats_shm_name, strerror(errno));
+        shm_unlink(g_stats_shm_name);
+        exit(EXIT_FAILURE);
+    }
+
+    memcpy(addr, g_stats, sizeof(struct filltest_stats));
+    g_stats = (struct filltest_stats*)addr;
+    atexit(stats_shm_remove);
+
+    printf("Publishing live statistics in shared memory %s\n",
+           g_stats_shm_name);
+#else
+    (void)name;
+    printf("Shared memory statistics are not supported on this platform.\n");
+    exit(EXIT_FAILURE);
+#endif
+}
+
+/* copy a consistent snapshot of a statistics struct using the seqlock */
+int stats_snapshot(const struct filltest_stats* src, struct filltest_stats* dst)
+{
+    uint32_t s1, s2;
+    unsigned int tries;
+
+    for (tries = 0; tries < 1000000; ++tries)
+    {
+        s1 = __atomic_load_n(&src->seq, __ATOMIC_ACQUIRE);
+        if (s1 & 1) continue;
+        memcpy(dst, (const void*)src, sizeof(*dst));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        s2 = __atomic_load_n(&src->seq, __ATOMIC_RELAXED);
+        if (s1 == s2) return 1;
+    }
+    return 0;
+}
+
+/* names of phases for display */
+const char* stats_phase_name(uint32_t phase)
+{
+    switch (phase) {
+    case PHASE_IDLE: return "idle";
+    case PHASE_UNLINK: return "unlink";
+    case PHASE_WRITE: return "write";
+    case PHASE_VERIFY: return "verify";
+    case PHASE_DONE: return "done";
+    default: return "unknown";
+    }
+}
+
+/* print latency summary line of one direction, if any requests were done */
+void stats_print_latency(const struct filltest_stats* st, enum stats_dir dir)
+{
+    double p50, p99;
+
+    if (st->lat_count[dir] == 0) return;
+
+    /* percentiles are bucket upper bounds, do not exceed the maximum */
+    p50 = stats_lat_percentile(st->lat_hist[dir], st->lat_count[dir], 50);
+    p99 = stats_lat_percentile(st->lat_hist[dir], st->lat_count[dir], 99);
+    if (p50 > st->lat_max[dir]) p50 = st->lat_max[dir];
+    if (p99 > st->lat_max[dir]) p99 = st->lat_max[dir];
+
+    printf("%s latency: avg %.3f ms, p50 %.3f ms, p99 %.3f ms, "
+           "max %.3f ms (%"PRIu64" requests)\n",
+           dir == DIR_WRITE ? "write" : "read ",
+           st->lat_sum[dir] / st->lat_count[dir] * 1e3,
+           p50 * 1e3, p99 * 1e3, st->lat_max[dir] * 1e3,
+           st->lat_count[dir]);
+}
+
+/* viewer for a shared memory statistics segment of another process */
+void stats_top(const char* name)
+{
+#if HAVE_SHM
+    char shm_name[64];
+    int fd;
+    const struct filltest_stats* src;
+    struct filltest_stats cur, prev;
+    int have_prev = 0;
+
+    if (name[0] >= '0' && name[0] <= '9')
+        snprintf(shm_name, sizeof(shm_name), "/disk-filltest.%s", name);
+    else if (name[0] != '/')
+        snprintf(shm_name, sizeof(shm_name), "/%s", name);
+    else
+        snprintf(shm_name, sizeof(shm_name), "%s", name);
+
+    fd = shm_open(shm_name, O_RDONLY, 0);
+    if (fd < 0) {
+        printf("Error opening shared memory segment %s: %s\n",
+               shm_name, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    src = (const struct filltest_stats*)mmap(
+        NULL, sizeof(struct filltest_stats), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (src == MAP_FAILED) {
+        printf("Error mapping shared memory segment %s: %s\n",
+               shm_name, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    if (src->magic != STATS_MAGIC || src->version != STATS_VERSION ||
+        src->size != sizeof(struct filltest_stats)) {
+        printf("Shared memory segment %s has unknown layout.\n", shm_name);
+        exit(EXIT_FAILURE);
+    }
+    memset(&prev, 0, sizeof(prev));
+
+    while (1)
+    {
+        double now, rate = 0, avg = 0, elapsed;
+
+        if (!stats_snapshot(src, &cur)) {
+            sleep(1);
+            continue;
+        }
+
+        now = timestamp();
+        elapsed = now - cur.phase_start_time;
+        if (elapsed > 0)
+            avg = cur.phase_bytes / 1024.0 / 1024.0 / elapsed;
+        if (have_prev && cur.update_time > prev.update_time)
+            rate = (double)(cur.bytes_written + cur.bytes_read
+                            - prev.bytes_written - prev.bytes_read)
+                / 1024.0 / 1024.0 / (cur.update_time - prev.update_time);
+
+        printf("\033[H\033[J");
+        printf("disk-filltest pid %d seed %u  phase %s  repeat %u\n",
+               (int)cur.pid, cur.seed, stats_phase_name(cur.phase),
+               cur.repeat);
+        printf("file random-%08u  files done %u of %u  in-flight %u\n",
+               cur.filenum, cur.files_done, cur.files_expected, cur.inflight);
+        printf("phase %.0f MiB in %.0f s, avg %.1f MiB/s, now %.1f MiB/s\n",
+               cur.phase_bytes / 1024.0 / 1024.0, elapsed, avg, rate);
+        printf("total written %.0f MiB, read %.0f MiB, "
+               "errors %u, mismatches %u\n",
+               cur.bytes_written / 1024.0 / 1024.0,
+               cur.bytes_read / 1024.0 / 1024.0,
+               cur.errors, cur.mismatches);
+
+        stats_print_latency(&cur, DIR_WRITE);
+        stats_print_latency(&cur, DIR_READ);
+        fflush(stdout);
+
+        if (cur.phase == PHASE_DONE || kill(cur.pid, 0) != 0)
+            break;
+
+        prev = cur;
+        have_prev = 1;
+        sleep(1);
+    }
+
+    exit(EXIT_SUCCESS);
+#else
+    (void)name;
+    printf("Shared memory statistics are not supported on this platform.\n");
+    exit(EXIT_FAILURE);
+#endif
+}
+
+/******************************************************************************/
+/* I/O backends: all operations on the random files go through g_backend.
+ *
+ * - posix: the file system in the current directory (default).
+ * - tmpfs: posix in a private directory on a tmpfs, e.g. /dev/shm.
+ * - mem:   files held in memory, with injectable latency distributions.
+ * - null:  like mem, but data written is discarded and reads return EOF.
+ *
+ * The mem and null backends allow measuring the end-to-end throughput of the
+ * tool without any disk involved. Handles are small integers like file
+ * descriptors. Reads and writes are positioned and may be issued concurrently
+ * by the I/O threads of an engine, all other operations only by the main
+ * thread. */
+
+struct io_backend {
+    const char* name;
+    int (*open)(const char* path, int flags);
+    int (*close)(int fh);
+    int (*unlink)(const char* path);
+    ssize_t (*pread)(int fh, void* buf, size_t size, uint64_t offset);
+    ssize_t (*pwrite)(int fh, const void* buf, size_t size, uint64_t offset);
+    /* positioned vectored I/O into several buffers, optional */
+    ssize_t (*preadv)(int fh, const struct iovec* iov, int iovcnt,
+                      uint64_t offset);
+    ssize_t (*pwritev)(int fh, const struct iovec* iov, int iovcnt,
+                       uint64_t offset);
+    /* get size of a file by name or of an open file */
+    int (*stat)(const char* path, uint64_t* size);
+    int (*fstat)(int fh, uint64_t* size);
+    /* get space available for new files, returns -1 if unknown */
+    int (*statfs)(uint64_t* avail);
+    /* write back data of an open file and drop it from the page cache */
+    int (*evict)(int fh);
+    /* start write-back of a range of an open file, and wait for it if wait
+     * is set, size 0 extends to the end of file. Optional. */
+    int (*writeback)(int fh, uint64_t offset, uint64_t size, int wait);
+    /* map a read-only window of an open file, may shorten *size, returns
+     * NULL if the window cannot be mapped */
+    const void* (*map)(int fh, uint64_t offset, size_t* size);
+    void (*unmap)(int fh, const void* addr, size_t size);
+};
+
+/* for compatibility with windows, use O_BINARY if available */
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+/* direct I/O is not available on all platforms */
+#ifndef O_DIRECT
+#define O_DIRECT 0
+#endif
+
+int posix_open(const char* path, int flags)
+{
+    if (gopt_direct) flags |= O_DIRECT;
+    return open(path, flags | O_BINARY, 0600);
+}
+
+int posix_close(int fh)
+{
+    return close(fh);
+}
+
+int posix_unlink(const char* path)
+{
+    return unlink(path);
+}
+
+ssize_t posix_pread(int fh, void* buf, size_t size, uint64_t offset)
+{
+#if HAVE_PREADV2
+    if (gopt_dontcache) {
+        struct iovec iov;
+        iov.iov_base = buf;
+        iov.iov_len = size;
+        return preadv2(fh, &iov, 1, (off_t)offset, RWF_DONTCACHE);
+    }
+#endif
+    return pread(fh, buf, size, (off_t)offset);
+}
+
+ssize_t posix_pwrite(int fh, const void* buf, size_t size, uint64_t offset)
+{
+#if HAVE_PREADV2
+    if (gopt_dontcache) {
+        struct iovec iov;
+        iov.iov_base = (void*)buf;
+        iov.iov_len = size;
+        return pwritev2(fh, &iov, 1, (off_t)offset, RWF_DONTCACHE);
+    }
+#endif
+    return pwrite(fh, buf, size, (off_t)offset);
+}
+
+#if HAVE_PREADV
+ssize_t posix_preadv(int fh, const struct iovec* iov, int iovcnt,
+                     uint64_t offset)
+{
+#if HAVE_PREADV2
+    if (gopt_dontcache)
+        return preadv2(fh, iov, iovcnt, (off_t)offset, RWF_DONTCACHE);
+#endif
+    return preadv(fh, iov, iovcnt, (off_t)offset);
+}
+
+ssize_t posix_pwritev(int fh, const struct iovec* iov, int iovcnt,
+                      uint64_t offset)
+{
+#if HAVE_PREADV2
+    if (gopt_dontcache)
+        return pwritev2(fh, iov, iovcnt, (off_t)offset, RWF_DONTCACHE);
+#endif
+    return pwritev(fh, iov, iovcnt, (off_t)offset);
+}
+#else
+#define posix_preadv NULL
+#define posix_pwritev NULL
+#endif
+
+int posix_stat(const char* path, uint64_t* size)
+{
+    struct stat st;
+    if (stat(path, &st) != 0) return -1;
+    *size = st.st_size;
+    return 0;
+}
+
+int posix_fstat(int fh, uint64_t* size)
+{
+    struct stat st;
+    if (fstat(fh, &st) != 0) return -1;
+    *size = st.st_size;
+    return 0;
+}
+
+int posix_statfs(uint64_t* avail)
+{
+#if HAVE_STATVFS
+    struct statvfs buf;
+
+    /* only the blocks available to unprivileged users can be filled */
+    if (statvfs(".", &buf) != 0) return -1;
+    *avail = (uint64_t)(buf.f_bavail) * (uint64_t)(buf.f_frsize);
+    return 0;
+#else
+    (void)avail;
+    return -1;
+#endif
+}
+
+int posix_evict(int fh)
+{
+#if HAVE_FSYNC
+    if (fsync(fh) != 0) return -1;
+#endif
+#if defined(POSIX_FADV_DONTNEED)
+    errno = posix_fadvise(fh, 0, 0, POSIX_FADV_DONTNEED);
+    if (errno != 0) return -1;
+#endif
+    (void)fh;
+    return 0;
+}
+
+#if HAVE_SYNC_FILE_RANGE
+int posix_writeback(int fh, uint64_t offset, uint64_t size, int wait)
+{
+    unsigned int flags = SYNC_FILE_RANGE_WRITE;
+    if (wait)
+        flags |= SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WAIT_AFTER;
+    return sync_file_range(fh, (off_t)offset, (off_t)size, flags);
+}
+#else
+#define posix_writeback NULL
+#endif
+
+const void* posix_map(int fh, uint64_t offset, size_t* size)
+{
+#if HAVE_MMAP
+    void* addr = mmap(NULL, *size, PROT_READ, MAP_SHARED, fh, (off_t)offset);
+    if (addr == MAP_FAILED) return NULL;
+    /* start readahead of the whole window now */
+    posix_madvise(addr, *size, POSIX_MADV_SEQUENTIAL);
+    posix_madvise(addr, *size, POSIX_MADV_WILLNEED);
+    return addr;
+#else
+    (void)fh;
+    (void)offset;
+    (void)size;
+    errno = ENOSYS;
+    return NULL;
+#endif
+}
+
+void posix_unmap(int fh, const void* addr, size_t size)
+{
+    (void)fh;
+#if HAVE_MMAP
+    munmap((void*)addr, size);
+#else
+    (void)addr;
+    (void)size;
+#endif
+}
+
+const struct io_backend g_backend_posix = {
+    "posix", posix_open, posix_close, posix_unlink, posix_pread, posix_pwrite,
+    posix_preadv, posix_pwritev, posix_stat, posix_fstat, posix_statfs,
+    posix_evict, posix_writeback, posix_map, posix_unmap
+};
+
+/* private directory created by the tmpfs backend */
+char g_tmpfs_dir[256] = "";
+
+/* remove random files and private directory of the tmpfs backend at exit */
+void tmpfs_cleanup(void)
+{
+    char filename[32];
+    unsigned int filenum;
+
+    if (!g_tmpfs_dir[0]) return;
+
+    for (filenum = 0; filenum < UINT_MAX; ++filenum) {
+        sprintf(filename, "random-%08u", filenum);
+        if (unlink(filename) != 0) break;
+    }
+    if (chdir("/") == 0)
+        rmdir(g_tmpfs_dir);
+    g_tmpfs_dir[0] = 0;
+}
+
+/* create and change into a private directory on a tmpfs */
+void tmpfs_setup(const char* dir)
+{
+    snprintf(g_tmpfs_dir, sizeof(g_tmpfs_dir), "%s/disk-filltest.%d",
+             dir ? dir : "/dev/shm", (int)getpid());
+
+    if (mkdir(g_tmpfs_dir, 0700) != 0 || chdir(g_tmpfs_dir) != 0) {
+        printf("Error creating tmpfs directory %s: %s\n",
+               g_tmpfs_dir, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    atexit(tmpfs_cleanup);
+}
+
+/* size of the memory chunks holding mem backend files */
+#define MEM_CHUNK_SIZE (1024 * 1024)
+
+/* a file of the mem backend */
+struct mem_file {
+    char name[32];
+    uint64_t size;
+    char** chunks;       /* chunks of file data, NULL if never written */
+    size_t chunks_size;  /* number of chunk pointers allocated */
+    int refs;            /* number of open handles */
+    int unlinked;        /* name was removed */
+};
+
+/* an open handle of the mem backend */
+struct mem_handle {
+    struct mem_file* file;
+};
+
+/* latency distributions for mem backend requests */
+enum mem_latency_dist { LAT_NONE, LAT_CONST, LAT_UNIFORM, LAT_EXP };
+
+struct mem_backend_state {
+    struct mem_file** files;     /* files by name, unlinked ones removed */
+    size_t files_size;
+    struct mem_handle* handles;  /* open handles, file == NULL if free */
+    size_t handles_size;
+    uint64_t capacity;           /* maximum bytes stored */
+    uint64_t used;               /* bytes in allocated chunks */
+    int discard;                 /* null backend: do not store data */
+    int lat_dist;                /* enum mem_latency_dist */
+    double lat_a, lat_b;         /* parameters of distribution in seconds */
+    uint64_t lat_rnd;            /* random state for latencies */
+};
+
+struct mem_backend_state g_mem = { NULL, 0, NULL, 0, 0, 0, 0, LAT_NONE,
+                                   0, 0, 1 };
+
+#if HAVE_PTHREAD
+/* serializes reads and writes of I/O threads on the mem backend state */
+pthread_mutex_t g_mem_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+void mem_lock(void)
+{
+#if HAVE_PTHREAD
+    pthread_mutex_lock(&g_mem_lock);
+#endif
+}
+
+void mem_unlock(void)
+{
+#if HAVE_PTHREAD
+    pthread_mutex_unlock(&g_mem_lock);
+#endif
+}
+
+/* parse latency distribution: const:<us>, uniform:<min>:<max>, exp:<mean> */
+void mem_parse_latency(const char* spec)
+{
+    double a = 0, b = 0;
+
+    if (sscanf(spec, "const:%lf", &a) == 1) {
+        g_mem.lat_dist = LAT_CONST;
+    }
+    else if (sscanf(spec, "uniform:%lf:%lf", &a, &b) == 2 && a <= b) {
+        g_mem.lat_dist = LAT_UNIFORM;
+    }
+    else if (sscanf(spec, "exp:%lf", &a) == 1) {
+        g_mem.lat_dist = LAT_EXP;
+    }
+    else {
+        printf("Invalid latency distribution %s, "
+               "use const:<us>, uniform:<min>:<max> or exp:<mean>.\n", spec);
+        exit(EXIT_FAILURE);
+    }
+    g_mem.lat_a = a / 1e6;
+    g_mem.lat_b = b / 1e6;
+}
+
+/* delay a mem backend request according to the latency distribution */
+void mem_inject_latency(void)
+{
+    double delay, u;
+    struct timespec ts;
+
+    if (g_mem.lat_dist == LAT_NONE) return;
+
+    /* concurrent requests sleep in parallel, like on a device queue */
+    mem_lock();
+    u = (double)(lcg_random(&g_mem.lat_rnd) >> 11) / 9007199254740992.0;
+    mem_unlock();
+
+    if (g_mem.lat_dist == LAT_CONST)
+        delay = g_mem.lat_a;
+    else if (g_mem.lat_dist == LAT_UNIFORM)
+        delay = g_mem.lat_a + u * (g_mem.lat_b - g_mem.lat_a);
+    else
+        delay = -g_mem.lat_a * log(1.0 - u);
+
+    ts.tv_sec = (time_t)delay;
+    ts.tv_nsec = (long)((delay - (double)ts.tv_sec) * 1e9);
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR) { }
+}
+
+/* find a mem file by name, returns index or -1 */
+int mem_find(const char* path)
+{
+    size_t i;
+    for (i = 0; i < g_mem.files_size; ++i) {
+        if (g_mem.files[i] && strcmp(g_mem.files[i]->name, path) == 0)
+            return (int)i;
+    }
+    return -1;
+}
+
+/* release data chunks of a mem file */
+void mem_truncate(struct mem_file* f)
+{
+    size_t i;
+
+    /* the null backend only accounts the file size */
+    if (g_mem.discard)
+        g_mem.used -= f->size;
+
+    for (i = 0; i < f->chunks_size; ++i) {
+        if (f->chunks[i]) {
+            free(f->chunks[i]);
+            g_mem.used -= MEM_CHUNK_SIZE;
+        }
+    }
+    free(f->chunks);
+    f->chunks = NULL;
+    f->chunks_size = 0;
+    f->size = 0;
+}
+
+/* free a mem file if it is unlinked and no longer open */
+void mem_release(struct mem_file* f)
+{
+    if (f->unlinked && f->refs == 0) {
+        mem_truncate(f);
+        free(f);
+    }
+}
+
+int mem_open(const char* path, int flags)
+{
+    struct mem_file* f;
+    int idx = mem_find(path);
+    size_t h;
+
+    if (idx < 0) {
+        if (!(flags & O_CREAT)) {
+            errno = ENOENT;
+            return -1;
+        }
+        f = (struct mem_file*)calloc(1, sizeof(struct mem_file));
+        if (!f) {
+            errno = ENOMEM;
+            return -1;
+        }
+        snprintf(f->name, sizeof(f->name), "%s", path);
+
+        /* reuse a free slot in file table or append */
+        for (idx = 0; idx < (int)g_mem.files_size; ++idx) {
+            if (!g_mem.files[idx]) break;
+        }
+        if (idx == (int)g_mem.files_size) {
+            struct mem_file** nf = (struct mem_file**)realloc(
+                g_mem.files, sizeof(struct mem_file*) * (idx + 1));
+            if (!nf) {
+                free(f);
+                errno = ENOMEM;
+                return -1;
+            }
+            g_mem.files = nf;
+            g_mem.files_size = idx + 1;
+        }
+        g_mem.files[idx] = f;
+    }
+    f = g_mem.files[idx];
+
+    if (flags & O_TRUNC)
+        mem_truncate(f);
+
+    for (h = 0; h < g_mem.handles_size; ++h) {
+        if (!g_mem.handles[h].file) break;
+    }
+    if (h == g_mem.handles_size) {
+        struct mem_handle* nh = (struct mem_handle*)realloc(
+            g_mem.handles, sizeof(struct mem_handle) * (h + 1));
+        if (!nh) {
+            errno = ENOMEM;
+            return -1;
+        }
+        g_mem.handles = nh;
+        g_mem.handles_size = h + 1;
+    }
+    g_mem.handles[h].file = f;
+    f->refs++;
+    return (int)h;
+}
+
+/* check that a mem handle is valid */
+int mem_valid(int fh)
+{
+    if (fh < 0 || (size_t)fh >= g_mem.handles_size ||
+        !g_mem.handles[fh].file) {
+        errno = EBADF;
+        return 0;
+    }
+    return 1;
+}
+
+int mem_close(int fh)
+{
+    struct mem_file* f;
+
+    if (!mem_valid(fh)) return -1;
+    f = g_mem.handles[fh].file;
+    g_mem.handles[fh].file = NULL;
+    f->refs--;
+    mem_release(f);
+    return 0;
+}
+
+int mem_unlink(const char* path)
+{
+    int idx = mem_find(path);
+    struct mem_file* f;
+
+    if (idx < 0) {
+        errno = ENOENT;
+        return -1;
+    }
+    f = g_mem.files[idx];
+    g_mem.files[idx] = NULL;
+    f->unlinked = 1;
+    mem_release(f);
+    return 0;
+}
+
+ssize_t mem_pread(int fh, void* buf, size_t size, uint64_t pos)
+{
+    struct mem_file* f;
+    size_t done = 0;
+
+    mem_inject_latency();
+    mem_lock();
+    if (!mem_valid(fh)) {
+        mem_unlock();
+        return -1;
+    }
+    f = g_mem.handles[fh].file;
+
+    while (!g_mem.discard && done < size && pos < f->size)
+    {
+        uint64_t chunk = pos / MEM_CHUNK_SIZE;
+        size_t off = pos % MEM_CHUNK_SIZE;
+        size_t n = MEM_CHUNK_SIZE - off;
+
+        if (n > size - done) n = size - done;
+        if (n > f->size - pos) n = f->size - pos;
+
+        if (chunk < f->chunks_size && f->chunks[chunk])
+            memcpy((char*)buf + done, f->chunks[chunk] + off, n);
+        else
+            memset((char*)buf + done, 0, n);
+
+        done += n;
+        pos += n;
+    }
+    mem_unlock();
+    return done;
+}
+
+/* write to a mem file, called with the lock held */
+ssize_t mem_pwrite_locked(int fh, const void* buf, size_t size, uint64_t pos)
+{
+    struct mem_file* f;
+    size_t done = 0;
+
+    if (!mem_valid(fh)) return -1;
+    f = g_mem.handles[fh].file;
+
+    if (g_mem.discard)
+    {
+        if (g_mem.used + size > g_mem.capacity) {
+            size = g_mem.capacity - g_mem.used;
+            if (size == 0) {
+                errno = ENOSPC;
+                return -1;
+            }
+        }
+        g_mem.used += size;
+        if (pos + size > f->size) f->size = pos + size;
+        return size;
+    }
+
+    while (done < size)
+    {
+        uint64_t chunk = pos / MEM_CHUNK_SIZE;
+        size_t off = pos % MEM_CHUNK_SIZE;
+        size_t n = MEM_CHUNK_SIZE - off;
+
+        if (n > size - done) n = size - done;
+
+        if (chunk >= f->chunks_size) {
+            size_t ns = f->chunks_size * 2;
+            char** nc;
+            if (ns <= chunk) ns = chunk + 64;
+            nc = (char**)realloc(f->chunks, sizeof(char*) * ns);
+            if (!nc) break;
+            memset(nc + f->chunks_size, 0,
+                   sizeof(char*) * (ns - f->chunks_size));
+            f->chunks = nc;
+            f->chunks_size = ns;
+        }
+        if (!f->chunks[chunk]) {
+            if (g_mem.used + MEM_CHUNK_SIZE > g_mem.capacity) {
+                errno = ENOSPC;
+                break;
+            }
+            f->chunks[chunk] = (char*)calloc(1, MEM_CHUNK_SIZE);
+            if (!f->chunks[chunk]) {
+                errno = ENOSPC;
+                break;
+            }
+            g_mem.used += MEM_CHUNK_SIZE;
+        }
+
+        memcpy(f->chunks[chunk] + off, (const char*)buf + done, n);
+        done += n;
+        pos += n;
+        if (pos > f->size) f->size = pos;
+    }
+    return done == 0 && size != 0 ? -1 : (ssize_t)done;
+}
+
+ssize_t mem_pwrite(int fh, const void* buf, size_t size, uint64_t pos)
+{
+    ssize_t r;
+
+    mem_inject_latency();
+    mem_lock();
+    r = mem_pwrite_locked(fh, buf, size, pos);
+    mem_unlock();
+    return r;
+}
+
+int mem_stat(const char* path, uint64_t* size)
+{
+    int idx = mem_find(path);
+    if (idx < 0) {
+        errno = ENOENT;
+        return -1;
+    }
+    *size = g_mem.files[idx]->size;
+    return 0;
+}
+
+int mem_fstat(int fh, uint64_t* size)
+{
+    if (!mem_valid(fh)) return -1;
+    *size = g_mem.handles[fh].file->size;
+    return 0;
+}
+
+int mem_statfs(uint64_t* avail)
+{
+    *avail = g_mem.capacity - g_mem.used;
+    return 0;
+}
+
+int mem_evict(int fh)
+{
+    return mem_valid(fh) ? 0 : -1;
+}
+
+/* return a pointer into the chunk holding offset, windows do not cross
+ * chunks */
+const void* mem_map(int fh, uint64_t offset, size_t* size)
+{
+    uint64_t chunk = offset / MEM_CHUNK_SIZE;
+    size_t off = offset % MEM_CHUNK_SIZE;
+    const void* addr = NULL;
+    struct mem_file* f;
+
+    mem_inject_latency();
+    mem_lock();
+    if (mem_valid(fh))
+    {
+        f = g_mem.handles[fh].file;
+        if (offset < f->size && chunk < f->chunks_size && f->chunks[chunk]) {
+            if (*size > MEM_CHUNK_SIZE - off) *size = MEM_CHUNK_SIZE - off;
+            if (*size > f->size - offset) *size = f->size - offset;
+            addr = f->chunks[chunk] + off;
+        }
+        else {
+            errno = EINVAL;
+        }
+    }
+    mem_unlock();
+    return addr;
+}
+
+void mem_unmap(int fh, const void* addr, size_t size)
+{
+    (void)fh;
+    (void)addr;
+    (void)size;
+}
+
+const struct io_backend g_backend_mem = {
+    "mem", mem_open, mem_close, mem_unlink, mem_pread, mem_pwrite, NULL, NULL,
+    mem_stat, mem_fstat, mem_statfs, mem_evict, NULL, mem_map, mem_unmap
+};
+
+const struct io_backend g_backend_null = {
+    "null", mem_open, mem_close, mem_unlink, mem_pread, mem_pwrite, NULL, NULL,
+    mem_stat, mem_fstat, mem_statfs, mem_evict, NULL, mem_map, mem_unmap
+};
+
+/* current I/O backend */
+const struct io_backend* g_backend = &g_backend_posix;
+
+/* Fault injection backend: wraps the previously selected backend and injects
+ * errors and data corruption at exact file offsets, to exercise the error
+ * paths of the tool at memory speed. Faults are given as kind:file:offset,
+ * except enospc:bytes which counts bytes written over all files.
+ *
+ * - eio-read, eio-write: requests covering offset fail with EIO.
+ * - short-read, short-write: the first request covering offset transfers only
+ *   the bytes up to offset.
+ * - enospc: writes fail with ENOSPC once the total reaches bytes.
+ * - bitflip: reads return offset's byte with its lowest bit flipped.
+ * - zero: reads return the 512 byte sector containing offset zeroed.
+ * - misplace: reads return the 4 KiB block containing offset swapped with
+ *   the neighboring block of the same request, like a misdirected I/O. */
+
+enum fault_kind {
+    FAULT_EIO_READ, FAULT_EIO_WRITE, FAULT_SHORT_READ, FAULT_SHORT_WRITE,
+    FAULT_ENOSPC, FAULT_BITFLIP, FAULT_ZERO, FAULT_MISPLACE, FAULT_KINDS
+};
+
+const char* g_fault_names[FAULT_KINDS] = {
+    "eio-read", "eio-write", "short-read", "short-write",
+    "enospc", "bitflip", "zero", "misplace"
+};
+
+struct fault {
+    int kind;            /* enum fault_kind */
+    unsigned int file;   /* file number */
+    uint64_t offset;     /* offset in file, or total bytes for enospc */
+    int fired;           /* number of times injected */
+};
+
+struct fault_state {
+    const struct io_backend* inner;  /* wrapped backend */
+    struct fault faults[32];
+    unsigned int faults_size;
+    unsigned int* handle_file;       /* file number of each handle */
+    size_t handles_size;
+    uint64_t written;                /* total bytes written */
+};
+
+struct fault_state g_fault;
+
+#if HAVE_PTHREAD
+/* serializes requests of I/O threads, faults are not a performance path */
+pthread_mutex_t g_fault_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/* parse a size with optional k, m, g or t suffix (binary units) */
+uint64_t parse_size(const char* str, const char** end)
+{
+    char* e;
+    uint64_t v = strtoull(str, &e, 10);
+
+    switch (*e) {
+    case 't': case 'T': v <<= 10; /* fall through */
+    case 'g': case 'G': v <<= 10; /* fall through */
+    case 'm': case 'M': v <<= 10; /* fall through */
+    case 'k': case 'K': v <<= 10; ++e; break;
+    default: break;
+    }
+    if (end) *end = e;
+    return v;
+}
+
+/* track file number of a new handle */
+int fault_track(int fh, const char* path)
+{
+    unsigned int filenum = UINT_MAX;
+
+    if (fh < 0) return fh;
+
+    if ((size_t)fh >= g_fault.handles_size) {
+        size_t ns = fh + 64;
+        unsigned int* nf = (unsigned int*)realloc(
+            g_fault.handle_file, sizeof(unsigned int) * ns);
+        if (!nf) {
+            fprintf(stderr, "Out of memory in fault injection backend.\n");
+            exit(EXIT_FAILURE);
+        }
+        g_fault.handle_file = nf;
+        g_fault.handles_size = ns;
+    }
+
+    if (sscanf(path, "random-%u", &filenum) != 1)
+        filenum = UINT_MAX;
+    g_fault.handle_file[fh] = filenum;
+    return fh;
+}
+
+/* find a fault of given kind within [pos, pos + size) of a handle's file */
+struct fault* fault_find(int kind, int fh, uint64_t pos, size_t size)
+{
+    unsigned int i;
+    for (i = 0; i < g_fault.faults_size; ++i) {
+        struct fault* f = &g_fault.faults[i];
+        if (f->kind == kind && f->file == g_fault.handle_file[fh] &&
+            f->offset >= pos && f->offset < pos + size)
+            return f;
+    }
+    return NULL;
+}
+
+int fault_open(const char* path, int flags)
+{
+    return fault_track(g_fault.inner->open(path, flags), path);
+}
+
+int fault_close(int fh)
+{
+    return g_fault.inner->close(fh);
+}
+
+int fault_unlink(const char* path)
+{
+    return g_fault.inner->unlink(path);
+}
+
+void fault_lock(void)
+{
+#if HAVE_PTHREAD
+    pthread_mutex_lock(&g_fault_lock);
+#endif
+}
+
+void fault_unlock(void)
+{
+#if HAVE_PTHREAD
+    pthread_mutex_unlock(&g_fault_lock);
+#endif
+}
+
+/* read from the inner backend and corrupt the data, called with lock held */
+ssize_t fault_pread_locked(int fh, void* buf, size_t size, uint64_t pos)
+{
+    struct fault* f;
+    ssize_t rb = 0;
+    unsigned int i;
+
+    if ((f = fault_find(FAULT_EIO_READ, fh, pos, size)) != NULL) {
+        f->fired++;
+        errno = EIO;
+        return -1;
+    }
+    if ((f = fault_find(FAULT_SHORT_READ, fh, pos, size)) != NULL &&
+        !f->fired && f->offset > pos) {
+        f->fired++;
+        size = f->offset - pos;
+    }
+
+    rb = g_fault.inner->pread(fh, buf, size, pos);
+    if (rb <= 0) return rb;
+
+    /* corrupt data returned */
+    for (i = 0; i < g_fault.faults_size; ++i)
+    {
+        char* data = (char*)buf;
+        uint64_t off;
+
+        f = &g_fault.faults[i];
+        if (f->file != g_fault.handle_file[fh] ||
+            f->offset < pos || f->offset >= pos + rb)
+            continue;
+        off = f->offset - pos;
+
+        if (f->kind == FAULT_BITFLIP) {
+            data[off] ^= 1;
+            f->fired++;
+        }
+        else if (f->kind == FAULT_ZERO) {
+            uint64_t s = f->offset & ~(uint64_t)511, e = s + 512;
+            if (s < pos) s = pos;
+            if (e > pos + rb) e = pos + rb;
+            memset(data + (s - pos), 0, e - s);
+            f->fired++;
+        }
+        else if (f->kind == FAULT_MISPLACE) {
+            uint64_t a = f->offset & ~(uint64_t)4095, b;
+            char tmp[4096];
+
+            /* swap with the following or preceding block of this request */
+            if (a < pos || a + 4096 > pos + rb)
+                continue;
+            if (a + 8192 <= pos + rb)
+                b = a + 4096;
+            else if (a >= pos + 4096)
+                b = a - 4096;
+            else
+                continue;
+
+            memcpy(tmp, data + (a - pos), 4096);
+            memcpy(data + (a - pos), data + (b - pos), 4096);
+            memcpy(data + (b - pos), tmp, 4096);
+            f->fired++;
+        }
+    }
+    return rb;
+}
+
+ssize_t fault_pread(int fh, void* buf, size_t size, uint64_t pos)
+{
+    ssize_t r;
+
+    fault_lock();
+    r = fault_pread_locked(fh, buf, size, pos);
+    fault_unlock();
+    return r;
+}
+
+/* write to the inner backend unless a fault fires, called with lock held */
+ssize_t fault_pwrite_locked(int fh, const void* buf, size_t size, uint64_t pos)
+{
+    struct fault* f;
+    ssize_t wb;
+    unsigned int i;
+
+    if ((f = fault_find(FAULT_EIO_WRITE, fh, pos, size)) != NULL) {
+        f->fired++;
+        errno = EIO;
+        return -1;
+    }
+    if ((f = fault_find(FAULT_SHORT_WRITE, fh, pos, size)) != NULL &&
+        !f->fired && f->offset > pos) {
+        f->fired++;
+        size = f->offset - pos;
+    }
+    for (i = 0; i < g_fault.faults_size; ++i) {
+        f = &g_fault.faults[i];
+        if (f->kind != FAULT_ENOSPC) continue;
+        if (g_fault.written >= f->offset) {
+            f->fired++;
+            errno = ENOSPC;
+            return -1;
+        }
+        if (g_fault.written + size > f->offset)
+            size = f->offset - g_fault.written;
+    }
+
+    wb = g_fault.inner->pwrite(fh, buf, size, pos);
+    if (wb <= 0) return wb;
+    g_fault.written += wb;
+    return wb;
+}
+
+ssize_t fault_pwrite(int fh, const void* buf, size_t size, uint64_t pos)
+{
+    ssize_t r;
+
+    fault_lock();
+    r = fault_pwrite_locked(fh, buf, size, pos);
+    fault_unlock();
+    return r;
+}
+
+int fault_stat(const char* path, uint64_t* size)
+{
+    return g_fault.inner->stat(path, size);
+}
+
+int fault_fstat(int fh, uint64_t* size)
+{
+    return g_fault.inner->fstat(fh, size);
+}
+
+int fault_evict(int fh)
+{
+    return g_fault.inner->evict(fh);
+}
+
+/* faults are injected into reads, mapped windows would bypass them */
+const void* fault_map(int fh, uint64_t offset, size_t* size)
+{
+    (void)fh;
+    (void)offset;
+    (void)size;
+    errno = EINVAL;
+    return NULL;
+}
+
+void fault_unmap(int fh, const void* addr, size_t size)
+{
+    (void)fh;
+    (void)addr;
+    (void)size;
+}
+
+int fault_statfs(uint64_t* avail)
+{
+    unsigned int i;
+    int r = g_fault.inner->statfs(avail);
+
+    /* an injected ENOSPC limits the available space */
+    for (i = 0; i < g_fault.faults_size; ++i) {
+        const struct fault* f = &g_fault.faults[i];
+        if (f->kind != FAULT_ENOSPC) continue;
+        if (r != 0 || *avail > f->offset - g_fault.written) {
+            *avail = f->offset - g_fault.written;
+            r = 0;
+        }
+    }
+    return r;
+}
+
+const struct io_backend g_backend_fault = {
+    "fault", fault_open, fault_close, fault_unlink, fault_pread, fault_pwrite,
+    NULL, NULL, fault_stat, fault_fstat, fault_statfs, fault_evict, NULL,
+    fault_map, fault_unmap
+};
+
+/* print the faults injected at exit */
+void fault_report(void)
+{
+    unsigned int i;
+
+    printf("Fault injection:");
+    for (i = 0; i < g_fault.faults_size; ++i) {
+        const struct fault* f = &g_fault.faults[i];
+        if (f->kind == FAULT_ENOSPC)
+            printf(" %s:%"PRIu64" fired %d,",
+                   g_fault_names[f->kind], f->offset, f->fired);
+        else
+            printf(" %s:%u:%"PRIu64" fired %d,",
+                   g_fault_names[f->kind], f->file, f->offset, f->fired);
+    }
+    printf(" total written %"PRIu64" bytes.\n", g_fault.written);
+}
+
+/* add faults given as comma separated list */
+void fault_add(const char* spec)
+{
+    while (*spec)
+    {
+        struct fault* f;
+        size_t len = strcspn(spec, ":,");
+        const char* p = spec + len;
+        int k;
+
+        for (k = 0; k < FAULT_KINDS; ++k) {
+            if (strlen(g_fault_names[k]) == len &&
+                strncmp(spec, g_fault_names[k], len) == 0) break;
+        }
+        if (k == FAULT_KINDS || *p != ':' ||
+            g_fault.faults_size == sizeof(g_fault.faults) / sizeof(*f)) {
+            printf("Invalid fault specification %s, use kind:file:offset "
+                   "or enospc:bytes.\n", spec);
+            exit(EXIT_FAILURE);
+        }
+
+        f = &g_fault.faults[g_fault.faults_size++];
+        f->kind = k;
+        f->fired = 0;
+        if (k == FAULT_ENOSPC) {
+            f->file = UINT_MAX;
+            f->offset = parse_size(p + 1, &p);
+        }
+        else {
+            f->file = (unsigned int)strtoul(p + 1, (char**)&p, 10);
+            if (*p != ':') {
+                printf("Invalid fault specification %s, use kind:file:offset "
+                       "or enospc:bytes.\n", spec);
+                exit(EXIT_FAILURE);
+            }
+            f->offset = parse_size(p + 1, &p);
+        }
+
+        spec = (*p == ',') ? p + 1 : p;
+    }
+}
+
+/* wrap the selected backend with the fault injection backend */
+void fault_install(void)
+{
+    g_fault.inner = g_backend;
+    g_backend = &g_backend_fault;
+    atexit(fault_report);
+}
+
+/* select backend from specification name[:argument] */
+void backend_select(const char* spec)
+{
+    const char* arg = strchr(spec, ':');
+    size_t len = arg ? (size_t)(arg - spec) : strlen(spec);
+
+    if (arg) ++arg;
+
+    if (len == 5 && strncmp(spec, "posix", 5) == 0) {
+        g_backend = &g_backend_posix;
+    }
+    else if (len == 5 && strncmp(spec, "tmpfs", 5) == 0) {
+        g_backend = &g_backend_posix;
+        tmpfs_setup(arg);
+    }
+    else if ((len == 3 && strncmp(spec, "mem", 3) == 0) ||
+             (len == 4 && strncmp(spec, "null", 4) == 0)) {
+        g_backend = len == 3 ? &g_backend_mem : &g_backend_null;
+        g_mem.discard = (len == 4);
+        g_mem.capacity = (uint64_t)(arg ? atoi(arg) : 1024) * 1024 * 1024;
+    }
+    else {
+        printf("Unknown I/O backend %s, use posix, tmpfs[:dir], "
+               "mem[:MiB] or null[:MiB].\n", spec);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* name of the current I/O mode */
+const char* io_mode_name(void)
+{
+    return gopt_direct ? "direct" : gopt_dontcache ? "dontcache" : "buffered";
+}
+
+/* check whether the file system supports uncached buffered I/O by writing
+ * and reading a probe file, or by reading the first random file with -r */
+int dontcache_supported(void)
+{
+#if HAVE_PREADV2
+    const char* filename = gopt_readonly ?
+        "random-00000000" : "disk-filltest.probe";
+    struct iovec iov;
+    ssize_t r = 0;
+    int fd;
+
+    if (g_backend != &g_backend_posix) return 0;
+
+    fd = open(filename, gopt_readonly ? O_RDONLY : O_RDWR | O_CREAT | O_TRUNC,
+              0600);
+    if (fd < 0) return 0;
+    iov.iov_base = buffer_alloc(BLOCK_ALIGN);
+    iov.iov_len = BLOCK_ALIGN;
+    memset(iov.iov_base, 0, BLOCK_ALIGN);
+
+    /* unsupported file systems fail with EOPNOTSUPP */
+    if (!gopt_readonly)
+        r = pwritev2(fd, &iov, 1, 0, RWF_DONTCACHE);
+    if (r >= 0)
+        r = preadv2(fd, &iov, 1, 0, RWF_DONTCACHE);
+
+    close(fd);
+    if (!gopt_readonly)
+        unlink(filename);
+    free(iov.iov_base);
+    return r >= 0;
+#else
+    return 0;
+#endif
+}
+
+/* fall back to buffered I/O if uncached buffered I/O is unavailable */
+void io_mode_setup(void)
+{
+    if (gopt_dontcache && !dontcache_supported()) {
+        printf("Uncached buffered I/O (RWF_DONTCACHE) is not supported here, "
+               "using buffered I/O.\n");
+        gopt_dontcache = 0;
+    }
+}
+
+/******************************************************************************/
+/* NUMA placement: on multi-socket machines the disk is attached to the PCIe
+ * root of one node. Generating and verifying data on another node moves every
+ * block across the interconnect, so the process is pinned to the CPUs of the
+ * disk's node and the buffer arena is bound to its memory. The node is found
+ * by walking up the sysfs device path of the disk to its PCI function. */
+
+#define NUMA_MAX_NODES 64
+
+/* NUMA node to run on: auto, off or a node number */
+const char* gopt_numa = "auto";
+
+struct numa_state {
+    int node;                /* node placed on, -1 if none */
+    char cpus[256];          /* cpulist of the node */
+    /* per node totals of the write and verify phases */
+    uint64_t bytes[NUMA_MAX_NODES][2];
+    double seconds[NUMA_MAX_NODES][2];
+};
+
+struct numa_state g_numa = { -1, "", { { 0, 0 } }, { { 0, 0 } } };
+
+/* read first line of a sysfs attribute, strip whitespace, 0 if missing */
+int sysfs_read(const char* dir, const char* attr, char* out, size_t size)
+{
+    char path[PATH_MAX + 64];
+    FILE* f;
+    size_t n, b = 0;
+
+    snprintf(path, sizeof(path), "%s/%s", dir, attr);
+    if ((f = fopen(path, "r")) == NULL) return 0;
+    n = fread(out, 1, size - 1, f);
+    fclose(f);
+    out[n] = 0;
+
+    /* SCSI VPD page 0x80 carries a four byte header before the serial */
+    if (strcmp(attr, "device/vpd_pg80") == 0)
+        b = n > 4 ? 4 : n;
+
+    while (b < n && (out[b] == ' ' || out[b] == '\t' || out[b] == '\n'))
+        ++b;
+    memmove(out, out + b, n - b + 1);
+    n -= b;
+    /* keep printable characters of the first line only */
+    for (b = 0; b < n; ++b) {
+        if (out[b] == '\n' || out[b] == 0) break;
+        if (out[b] < 0x20 || out[b] == '"' || out[b] == '\\') out[b] = '_';
+    }
+    while (b > 0 && (out[b - 1] == ' ' || out[b - 1] == '\t')) --b;
+    out[b] = 0;
+    return b != 0;
+}
+
+/* resolve the sysfs directory of the whole disk holding the current directory
+ * and its major:minor number */
+int sysfs_block_dir(char* dev, size_t dev_size, char dir[PATH_MAX])
+{
+#if HAVE_SYSFS
+    struct stat st;
+    char link[64], part[16];
+
+    if (stat(".", &st) != 0) return 0;
+
+    snprintf(dev, dev_size, "%u:%u",
+             (unsigned)major(st.st_dev), (unsigned)minor(st.st_dev));
+    snprintf(link, sizeof(link), "/sys/dev/block/%s", dev);
+    if (realpath(link, dir) == NULL) return 0;
+
+    /* attributes like the serial number belong to the whole disk */
+    if (sysfs_read(dir, "partition", part, sizeof(part))) {
+        char* slash = strrchr(dir, '/');
+        if (slash) *slash = 0;
+    }
+    return 1;
+#else
+    (void)dev;
+    (void)dev_size;
+    (void)dir;
+    return 0;
+#endif
+}
+
+/* find the NUMA node of the disk holding the current directory, -1 if
+ * unknown, e.g. for device mapper or virtual disks */
+int numa_device_node(char name[64])
+{
+    char dev[32], dir[PATH_MAX], value[16];
+    char* slash;
+
+    name[0] = 0;
+    if (g_backend != &g_backend_posix || !sysfs_block_dir(dev, sizeof(dev), dir))
+        return -1;
+
+    slash = strrchr(dir, '/');
+    snprintf(name, 64, "%s", slash ? slash + 1 : dir);
+
+    /* the first ancestor with a numa_node attribute is the PCI function */
+    while ((slash = strrchr(dir, '/')) != NULL &&
+           (size_t)(slash - dir) > strlen("/sys/devices"))
+    {
+        if (sysfs_read(dir, "numa_node", value, sizeof(value)))
+            return atoi(value);
+        *slash = 0;
+    }
+    return -1;
+}
+
+/* bind memory pages to the selected node before they are touched */
+void numa_bind(void* addr, size_t size)
+{
+#if HAVE_NUMA
+    unsigned long mask[NUMA_MAX_NODES / (8 * sizeof(unsigned long))];
+
+    if (g_numa.node < 0) return;
+
+    memset(mask, 0, sizeof(mask));
+    mask[g_numa.node / (8 * sizeof(unsigned long))] |=
+        1UL << (g_numa.node % (8 * sizeof(unsigned long)));
+    /* preferred instead of strict binding: fall back instead of OOM */
+    if (syscall(SYS_mbind, addr, size, MPOL_PREFERRED, mask,
+                (unsigned long)NUMA_MAX_NODES, 0UL) != 0) {
+        printf("Could not bind I/O buffers to NUMA node %d: %s\n",
+               g_numa.node, strerror(errno));
+    }
+#else
+    (void)addr;
+    (void)size;
+#endif
+}
+
+/* pin this process and all threads started later to the CPUs of a node */
+int numa_pin(int node)
+{
+#if HAVE_NUMA
+    char dir[64];
+    const char* p;
+    cpu_set_t set;
+    unsigned long lo, hi;
+    char* end;
+
+    snprintf(dir, sizeof(dir), "/sys/devices/system/node/node%d", node);
+    if (!sysfs_read(dir, "cpulist", g_numa.cpus, sizeof(g_numa.cpus)))
+        return 0;
+
+    /* parse a cpulist like 0-7,16-23 */
+    CPU_ZERO(&set);
+    for (p = g_numa.cpus; *p; p = (*end == ',') ? end + 1 : end)
+    {
+        lo = hi = strtoul(p, &end, 10);
+        if (end == p) break;
+        if (*end == '-')
+            hi = strtoul(end + 1, &end, 10);
+        for (; lo <= hi && lo < CPU_SETSIZE; ++lo)
+            CPU_SET(lo, &set);
+    }
+
+    if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+        printf("Could not pin to CPUs %s of NUMA node %d: %s\n",
+               g_numa.cpus, node, strerror(errno));
+        return 0;
+    }
+    return 1;
+#else
+    (void)node;
+    return 0;
+#endif
+}
+
+/* place process and buffers on the node of the disk or the requested node */
+void numa_setup(void)
+{
+    char name[64], online[64];
+    int node, dev_node;
+
+    if (strcmp(gopt_numa, "off") == 0)
+        return;
+
+    node = dev_node = numa_device_node(name);
+
+    if (strcmp(gopt_numa, "auto") != 0) {
+        node = atoi(gopt_numa);
+    }
+    else {
+        /* nothing to gain on single node machines */
+        if (!sysfs_read("/sys/devices/system/node", "online",
+                        online, sizeof(online)) ||
+            (strchr(online, '-') == NULL && strchr(online, ',') == NULL))
+            return;
+        if (node < 0) {
+            printf("NUMA node of %s unknown, threads and buffers not placed.\n",
+                   name[0] ? name : "the disk");
+            return;
+        }
+    }
+
+    if (node < 0 || node >= NUMA_MAX_NODES || !numa_pin(node)) {
+        printf("Cannot place threads and buffers on NUMA node %s.\n", gopt_numa);
+        exit(EXIT_FAILURE);
+    }
+    g_numa.node = node;
+
+    if (dev_node >= 0)
+        printf("NUMA: %s is attached to node %d, running on node %d with "
+               "CPUs %s.\n", name, dev_node, node, g_numa.cpus);
+    else
+        printf("NUMA: running on node %d with CPUs %s.\n", node, g_numa.cpus);
+}
+
+/* add the result of a write or verify phase to the totals of the node */
+void numa_account(int dir, uint64_t bytes, double seconds)
+{
+    if (g_numa.node < 0) return;
+    g_numa.bytes[g_numa.node][dir] += bytes;
+    g_numa.seconds[g_numa.node][dir] += seconds;
+}
+
+/* print throughput per node */
+void numa_report(void)
+{
+    int n, dir;
+    static const char* dir_name[2] = { "write", "verify" };
+
+    for (n = 0; n < NUMA_MAX_NODES; ++n)
+    {
+        for (dir = 0; dir < 2; ++dir)
+        {
+            if (g_numa.seconds[n][dir] <= 0) continue;
+            printf("NUMA node %d %s: %" PRIu64 " MiB with %.6f MiB/s.\n",
+                   n, dir_name[dir], g_numa.bytes[n][dir] / 1024 / 1024,
+                   g_numa.bytes[n][dir] / 1024.0 / 1024.0 /
+                   g_numa.seconds[n][dir]);
+        }
+    }
+}
+
+/******************************************************************************/
+/* I/O buffer arena: a single allocation holding the request buffers and the
+ * buffer of expected data, backed by huge pages if possible, so that
+ * generation and comparison do not suffer TLB misses with deep queues. It is
+ * allocated at startup and only replaced if a later configuration, e.g. of
+ * the sweep, needs more space. Policies:
+ *
+ * - hugetlb: anonymous mapping with MAP_HUGETLB from the reserved pool.
+ * - thp:     2 MiB aligned anonymous mapping with MADV_HUGEPAGE.
+ * - heap:    aligned allocation with regular pages.
+ *
+ * "auto" tries them in this order. */
+
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+enum arena_kind { ARENA_NONE, ARENA_HUGETLB, ARENA_THP, ARENA_HEAP };
+
+const char* g_arena_names[] = { "none", "hugetlb", "thp", "heap" };
+
+struct arena {
+    char* base;
+    size_t size;             /* bytes allocated */
+    size_t used;             /* bytes handed out */
+    size_t mapped;           /* bytes mapped including alignment slack */
+    char* map_base;          /* start of the mapping */
+    int kind;                /* enum arena_kind */
+    size_t huge;             /* bytes backed by huge pages, from smaps */
+};
+
+struct arena g_arena;
+
+/* huge page policy of the arena: auto, hugetlb, thp or off */
+const char* gopt_hugepages = "auto";
+
+/* format a size in bytes with binary unit */
+void format_size(uint64_t bytes, char output[16])
+{
+    if (bytes >= 1024 * 1024 && bytes % (1024 * 1024) == 0)
+        snprintf(output, 16, "%u MiB", (unsigned)(bytes / 1024 / 1024));
+    else if (bytes >= 1024 && bytes % 1024 == 0)
+        snprintf(output, 16, "%u KiB", (unsigned)(bytes / 1024));
+    else
+        snprintf(output, 16, "%u B", (unsigned)bytes);
+}
+
+/* release the arena */
+void arena_free(void)
+{
+#if HAVE_MMAP
+    if (g_arena.kind == ARENA_HUGETLB || g_arena.kind == ARENA_THP)
+        munmap(g_arena.map_base, g_arena.mapped);
+#endif
+    if (g_arena.kind == ARENA_HEAP)
+        free(g_arena.base);
+    memset(&g_arena, 0, sizeof(g_arena));
+}
+
+/* try to allocate the arena with the given policy */
+int arena_map(int kind, size_t size)
+{
+#if HAVE_MMAP && defined(MAP_ANONYMOUS)
+    if (kind == ARENA_HUGETLB)
+    {
+#if defined(MAP_HUGETLB)
+        void* p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p == MAP_FAILED) return 0;
+        g_arena.base = g_arena.map_base = (char*)p;
+        g_arena.mapped = size;
+        return 1;
+#else
+        return 0;
+#endif
+    }
+    if (kind == ARENA_THP)
+    {
+#if defined(MADV_HUGEPAGE)
+        /* over-allocate to align the arena to a huge page boundary */
+        size_t slack = HUGE_PAGE_SIZE;
+        char* p = (char*)mmap(NULL, size + slack, PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        uintptr_t a;
+        if (p == (char*)MAP_FAILED) return 0;
+        a = ((uintptr_t)p + HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1);
+        g_arena.map_base = p;
+        g_arena.mapped = size + slack;
+        g_arena.base = (char*)a;
+        if (madvise(g_arena.base, size, MADV_HUGEPAGE) != 0) {
+            munmap(p, size + slack);
+            return 0;
+        }
+        return 1;
+#else
+        return 0;
+#endif
+    }
+#endif
+    if (kind == ARENA_HEAP)
+    {
+        g_arena.base = (char*)buffer_alloc(size);
+        return 1;
+    }
+    (void)size;
+    return 0;
+}
+
+/* determine bytes of the arena backed by huge pages from /proc/self/smaps */
+size_t arena_huge_bytes(void)
+{
+    FILE* f = fopen("/proc/self/smaps", "r");
+    char line[256];
+    uintptr_t start, end, lo = (uintptr_t)g_arena.base;
+    uintptr_t hi = lo + g_arena.size;
+    int inside = 0;
+    unsigned long kb;
+    size_t huge = 0;
+
+    if (f == NULL) return 0;
+    while (fgets(line, sizeof(line), f))
+    {
+        if (sscanf(line, "%" SCNxPTR "-%" SCNxPTR " ", &start, &end) == 2) {
+            inside = (start < hi && end > lo);
+        }
+        else if (inside &&
+                 (sscanf(line, "AnonHugePages: %lu kB", &kb) == 1 ||
+                  sscanf(line, "Private_Hugetlb: %lu kB", &kb) == 1 ||
+                  sscanf(line, "Shared_Hugetlb: %lu kB", &kb) == 1)) {
+            huge += (size_t)kb * 1024;
+        }
+    }
+    fclose(f);
+    return huge;
+}
+
+/* make the arena hold at least size bytes and start handing out slices from
+ * its beginning again */
+void arena_reserve(size_t size)
+{
+    static const int order[] = { ARENA_HUGETLB, ARENA_THP, ARENA_HEAP };
+    static int logged = ARENA_NONE;
+    unsigned int i;
+    char total[16], huge[16];
+
+    g_arena.used = 0;
+    if (size <= g_arena.size)
+        return;
+
+    arena_free();
+    size = (size + HUGE_PAGE_SIZE - 1) & ~(size_t)(HUGE_PAGE_SIZE - 1);
+
+    for (i = 0; i < sizeof(order) / sizeof(*order); ++i)
+    {
+        if (strcmp(gopt_hugepages, "auto") != 0 &&
+            strcmp(gopt_hugepages, g_arena_names[order[i]]) != 0 &&
+            !(strcmp(gopt_hugepages, "off") == 0 && order[i] == ARENA_HEAP))
+            continue;
+        if (arena_map(order[i], size)) {
+            g_arena.kind = order[i];
+            break;
+        }
+    }
+    if (g_arena.kind == ARENA_NONE) {
+        printf("Error allocating %s huge page I/O buffers: %s\n",
+               gopt_hugepages, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    g_arena.size = size;
+
+    /* fault in all pages now, huge pages are only allocated on first touch */
+    numa_bind(g_arena.base, size);
+    memset(g_arena.base, 0, size);
+    g_arena.huge = arena_huge_bytes();
+
+    /* the arena grows with the request size of probes and sweeps, report it
+     * once and again only if it falls back to other pages */
+    if (g_arena.kind == logged)
+        return;
+    logged = g_arena.kind;
+    format_size(size, total);
+    format_size(g_arena.huge, huge);
+    printf("I/O buffer arena: %s %s pages, %s backed by huge pages.\n",
+           total, g_arena_names[g_arena.kind], huge);
+}
+
+/* hand out an aligned slice of the arena */
+void* arena_alloc(size_t size)
+{
+    char* p = g_arena.base + g_arena.used;
+
+    size = (size + BLOCK_ALIGN - 1) & ~(size_t)(BLOCK_ALIGN - 1);
+    if (g_arena.used + size > g_arena.size) {
+        printf("I/O buffer arena exhausted.\n");
+        exit(EXIT_FAILURE);
+    }
+    g_arena.used += size;
+    return p;
+}
+
+/******************************************************************************/
+/* I/O engines: the write and verify loops submit requests for blocks of a
+ * file and reap their completions, keeping up to g_queue_depth requests in
+ * flight. Completions may arrive out of order.
+ *
+ * - sync:    the main thread executes the requests submitted since the last
+ *            reap, runs of up to min(depth, IOV_MAX) adjacent blocks of a
+ *            file with one preadv() or pwritev().
+ * - threads: a pool of one thread per queue slot executes positioned reads
+ *            and writes, like fio's psync engine with numjobs = depth.
+ * - aio:     Linux native AIO with io_submit() and io_getevents() keeps
+ *            depth direct I/O requests in the kernel, posix backend only. */
+
+/* an I/O request of one block of a file */
+struct io_request {
+    int fh;
+    int dir;              /* enum stats_dir */
+    uint64_t offset;      /* file offset of the block */
+    size_t size;          /* size of the block */
+    size_t done;          /* bytes transferred by earlier partial requests */
+    char* buf;            /* aligned buffer of gopt_block_size bytes */
+    ssize_t result;       /* bytes transferred by last execution or -1 */
+    int error;            /* errno if result < 0 */
+    double latency;       /* duration of last execution in seconds */
+    struct io_request* next;
+};
+
+struct io_engine {
+    const char* name;
+    int (*start)(unsigned int depth);
+    void (*stop)(void);
+    /* queue a request for [offset + done, offset + size) */
+    void (*submit)(struct io_request* req);
+    /* wait for and return the next completed request */
+    struct io_request* (*reap)(void);
+    /* print statistics of the phase, optional */
+    void (*report)(const char* phase);
+};
+
+/* request size in bytes */
+size_t gopt_block_size = 1024 * 1024;
+
+/* number of requests in flight */
+unsigned int gopt_queue_depth = 1;
+
+/* engine selected with --engine, NULL for automatic choice */
+const char* gopt_engine = NULL;
+
+/* number of verify threads, 1 verifies with the I/O engine */
+unsigned int gopt_verify_threads = 1;
+
+/* buffers of the verify threads, two blocks per thread */
+char* g_verify_bufs = NULL;
+
+/* request pool, free list and effective queue depth */
+struct io_request* g_requests;
+struct io_request* g_requests_free;
+unsigned int g_queue_depth;
+
+/* a FIFO of requests */
+struct io_queue {
+    struct io_request *head, *tail;
+};
+
+void io_queue_push(struct io_queue* q, struct io_request* req)
+{
+    req->next = NULL;
+    if (q->tail) q->tail->next = req;
+    else q->head = req;
+    q->tail = req;
+}
+
+struct io_request* io_queue_pop(struct io_queue* q)
+{
+    struct io_request* req = q->head;
+    if (req) {
+        q->head = req->next;
+        if (!q->head) q->tail = NULL;
+    }
+    return req;
+}
+
+/* execute the remaining part of a request on the backend */
+void io_execute(struct io_request* req)
+{
+    double ts = timestamp();
+
+    if (req->dir == DIR_WRITE)
+        req->result = g_backend->pwrite(req->fh, req->buf + req->done,
+                                        req->size - req->done,
+                                        req->offset + req->done);
+    else
+        req->result = g_backend->pread(req->fh, req->buf + req->done,
+                                       req->size - req->done,
+                                       req->offset + req->done);
+    req->error = errno;
+    req->latency = timestamp() - ts;
+}
+
+/* The sync engine executes requests in the main thread. Requests submitted
+ * between two reaps are executed together: runs of blocks adjacent in the same
+ * file are transferred with one preadv() or pwritev(), so -Q sets the number
+ * of blocks batched per system call. */
+
+#ifndef IOV_MAX
+#define IOV_MAX 16
+#endif
+
+struct sync_engine {
+    struct io_queue pending, done;
+    struct iovec* iov;
+    unsigned int depth;
+    uint64_t requests, syscalls;  /* counted for the phase report */
+};
+
+struct sync_engine g_sync;
+
+int sync_start(unsigned int depth)
+{
+    memset(&g_sync, 0, sizeof(g_sync));
+    g_sync.depth = depth;
+    g_sync.iov = (struct iovec*)malloc(depth * sizeof(struct iovec));
+    return g_sync.iov != NULL;
+}
+
+void sync_stop(void)
+{
+    free(g_sync.iov);
+    g_sync.iov = NULL;
+}
+
+void sync_submit(struct io_request* req)
+{
+    io_queue_push(&g_sync.pending, req);
+}
+
+/* execute a run of adjacent requests with one vectored call. Requests not
+ * fully transferred by it, e.g. at an error, EOF or a full disk, are executed
+ * on their own to get their exact result. */
+void sync_execute_run(struct io_request* first, unsigned int n)
+{
+    struct io_request* req;
+    double ts = timestamp(), latency;
+    ssize_t r;
+    size_t len;
+    unsigned int i;
+
+    for (req = first, i = 0; i < n; req = req->next, ++i) {
+        g_sync.iov[i].iov_base = req->buf + req->done;
+        g_sync.iov[i].iov_len = req->size - req->done;
+    }
+    if (first->dir == DIR_WRITE)
+        r = g_backend->pwritev(first->fh, g_sync.iov, (int)n,
+                               first->offset + first->done);
+    else
+        r = g_backend->preadv(first->fh, g_sync.iov, (int)n,
+                              first->offset + first->done);
+    latency = timestamp() - ts;
+    g_sync.syscalls++;
+
+    for (req = first, i = 0; i < n; req = req->next, ++i)
+    {
+        len = req->size - req->done;
+        if (r >= (ssize_t)len || (r > 0 && i == 0)) {
+            req->result = r < (ssize_t)len ? r : (ssize_t)len;
+            req->error = 0;
+            req->latency = latency;
+            r -= req->result;
+        }
+        else {
+            io_execute(req);
+            g_sync.syscalls++;
+            r = 0;
+        }
+    }
+}
+
+/* execute all pending requests, batching adjacent blocks */
+void sync_flush(void)
+{
+    struct io_request *req, *last;
+    unsigned int n;
+
+    while ((req = g_sync.pending.head) != NULL)
+    {
+        /* find the run of requests continuing the previous one */
+        last = req;
+        n = 1;
+        while (last->next && n < g_sync.depth && n < IOV_MAX &&
+               last->next->fh == req->fh && last->next->dir == req->dir &&
+               last->next->offset + last->next->done ==
+               last->offset + last->size)
+        {
+            last = last->next;
+            ++n;
+        }
+        g_sync.pending.head = last->next;
+        if (!g_sync.pending.head) g_sync.pending.tail = NULL;
+        last->next = NULL;
+
+        if (n > 1 && (req->dir == DIR_WRITE ? g_backend->pwritev != NULL :
+                      g_backend->preadv != NULL)) {
+            sync_execute_run(req, n);
+        }
+        else {
+            for (last = req; last; last = last->next) {
+                io_execute(last);
+                g_sync.syscalls++;
+            }
+        }
+        g_sync.requests += n;
+
+        /* move the run to the completions in order */
+        while (req) {
+            last = req->next;
+            io_queue_push(&g_sync.done, req);
+            req = last;
+        }
+    }
+}
+
+struct io_request* sync_reap(void)
+{
+    if (!g_sync.done.head)
+        sync_flush();
+    return io_queue_pop(&g_sync.done);
+}
+
+/* print the number of requests per system call */
+void sync_report(const char* phase)
+{
+    if (g_sync.syscalls == 0 || g_sync.depth == 1) return;
+
+    printf("%s phase: %"PRIu64" requests in %"PRIu64" system calls, "
+           "%.2f blocks per call.\n", phase, g_sync.requests, g_sync.syscalls,
+           (double)g_sync.requests / g_sync.syscalls);
+    g_sync.requests = g_sync.syscalls = 0;
+}
+
+const struct io_engine g_engine_sync = {
+    "sync", sync_start, sync_stop, sync_submit, sync_reap, sync_report
+};
+
+#if HAVE_PTHREAD
+
+/* The threads engine hands requests to its I/O threads and back through two
+ * lock-free rings: bounded multi-producer multi-consumer queues where a
+ * sequence number per slot tells whether it is free or full (after Dmitry
+ * Vyukov). Positions and slots are padded to separate cache lines. A waiter
+ * spins for an adaptive number of rounds before it blocks on a condition
+ * variable, which producers only signal if someone sleeps. */
+
+#define CACHE_LINE 64
+
+/* spin rounds before blocking, adapted between these limits */
+#define RING_SPIN_MIN 64
+#define RING_SPIN_MAX 16384
+
+struct ring_slot {
+    uint64_t seq;
+    struct io_request* req;
+    char pad[CACHE_LINE - sizeof(uint64_t) - sizeof(struct io_request*)];
+};
+
+struct ring {
+    uint64_t head;           /* next position to consume */
+    char pad1[CACHE_LINE - sizeof(uint64_t)];
+    uint64_t tail;           /* next position to publish */
+    char pad2[CACHE_LINE - sizeof(uint64_t)];
+    uint32_t sleepers;       /* waiters blocked on cond */
+    uint32_t spin_limit;     /* current spin rounds before blocking */
+    char pad3[CACHE_LINE - 2 * sizeof(uint32_t)];
+    struct ring_slot* slots;
+    uint64_t mask;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    /* waits satisfied while spinning and waits which blocked */
+    uint64_t spins, blocks;
+};
+
+/* pause in a spin loop */
+void cpu_relax(void)
+{
+#if HAVE_RDTSC
+    __builtin_ia32_pause();
+#endif
+}
+
+/* allocate a ring of at least the given capacity */
+void ring_init(struct ring* r, unsigned int capacity)
+{
+    uint64_t size = 1, i;
+
+    while (size < capacity) size <<= 1;
+    memset(r, 0, sizeof(*r));
+    r->slots = (struct ring_slot*)buffer_alloc(size * sizeof(struct ring_slot));
+    for (i = 0; i < size; ++i)
+        r->slots[i].seq = i;
+    r->mask = size - 1;
+    r->spin_limit = RING_SPIN_MIN;
+#if defined(_SC_NPROCESSORS_ONLN)
+    /* spinning cannot succeed while the waiter occupies the only CPU */
+    if (sysconf(_SC_NPROCESSORS_ONLN) <= 1)
+        r->spin_limit = 0;
+#endif
+    pthread_mutex_init(&r->mutex, NULL);
+    pthread_cond_init(&r->cond, NULL);
+}
+
+void ring_free(struct ring* r)
+{
+    pthread_mutex_destroy(&r->mutex);
+    pthread_cond_destroy(&r->cond);
+    free(r->slots);
+    r->slots = NULL;
+}
+
+/* number of requests in the ring, approximate while others operate on it */
+unsigned int ring_size(struct ring* r)
+{
+    uint64_t tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+    uint64_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    return tail > head ? (unsigned int)(tail - head) : 0;
+}
+
+/* publish a request without waking waiters, spins while the ring is full */
+void ring_push(struct ring* r, struct io_request* req)
+{
+    uint64_t pos = __atomic_load_n(&r->tail, __ATOMIC_RELAXED), seq;
+    struct ring_slot* slot;
+
+    for (;;)
+    {
+        slot = &r->slots[pos & r->mask];
+        seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        if (seq == pos) {
+            if (__atomic_compare_exchange_n(&r->tail, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        }
+        else if ((int64_t)(seq - pos) < 0) {
+            /* full: a consumer has not released the slot yet */
+            cpu_relax();
+            pos = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+        }
+        else {
+            pos = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+        }
+    }
+    slot->req = req;
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+}
+
+/* take a request, NULL if the ring is empty */
+struct io_request* ring_pop(struct ring* r)
+{
+    uint64_t pos = __atomic_load_n(&r->head, __ATOMIC_RELAXED), seq;
+    struct ring_slot* slot;
+    struct io_request* req;
+
+    for (;;)
+    {
+        slot = &r->slots[pos & r->mask];
+        seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        if (seq == pos + 1) {
+            if (__atomic_compare_exchange_n(&r->head, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        }
+        else if ((int64_t)(seq - (pos + 1)) < 0) {
+            return NULL;
+        }
+        else {
+            pos = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+        }
+    }
+    req = slot->req;
+    __atomic_store_n(&slot->seq, pos + r->mask + 1, __ATOMIC_RELEASE);
+    return req;
+}
+
+/* wake blocked waiters after publishing, costs nothing if none sleeps */
+void ring_wake(struct ring* r)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&r->sleepers, __ATOMIC_RELAXED) != 0) {
+        pthread_mutex_lock(&r->mutex);
+        pthread_cond_broadcast(&r->cond);
+        pthread_mutex_unlock(&r->mutex);
+    }
+}
+
+/* wait until the ring is not empty or *stop is set: spin first, and block if
+ * that fails. The spin limit grows when spinning succeeds and shrinks when it
+ * was wasted. */
+void ring_wait(struct ring* r, const int* stop)
+{
+    uint32_t limit = __atomic_load_n(&r->spin_limit, __ATOMIC_RELAXED), i;
+
+    for (i = 0; i < limit; ++i)
+    {
+        if (ring_size(r) != 0 ||
+            (stop && __atomic_load_n(stop, __ATOMIC_ACQUIRE))) {
+            if (limit < RING_SPIN_MAX)
+                __atomic_store_n(&r->spin_limit, 2 * limit, __ATOMIC_RELAXED);
+            __atomic_fetch_add(&r->spins, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        cpu_relax();
+    }
+    if (limit > RING_SPIN_MIN)
+        __atomic_store_n(&r->spin_limit, limit / 2, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&r->blocks, 1, __ATOMIC_RELAXED);
+
+    pthread_mutex_lock(&r->mutex);
+    __atomic_fetch_add(&r->sleepers, 1, __ATOMIC_SEQ_CST);
+    while (ring_size(r) == 0 &&
+           !(stop && __atomic_load_n(stop, __ATOMIC_ACQUIRE)))
+        pthread_cond_wait(&r->cond, &r->mutex);
+    __atomic_fetch_sub(&r->sleepers, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&r->mutex);
+}
+
+/* shared state of the threads engine */
+struct threads_engine {
+    struct ring pending, done;
+    /* submitted requests not yet published, published in one batch */
+    struct io_request** batch;
+    unsigned int batch_size;
+    /* completions taken from the done ring in one batch, not yet returned */
+    struct io_request** reaped;
+    unsigned int reaped_pos, reaped_size;
+    unsigned int outstanding;  /* submitted and not yet reaped */
+    pthread_t* threads;
+    unsigned int threads_size;
+    int stop;
+    /* queue occupancy sampled at each reap */
+    uint64_t samples, pending_sum, executing_sum, done_sum;
+};
+
+struct threads_engine g_threads;
+
+/* worker thread: execute pending requests until stopped */
+void* threads_run(void* arg)
+{
+    struct io_request* req;
+    (void)arg;
+
+    for (;;)
+    {
+        if ((req = ring_pop(&g_threads.pending)) == NULL) {
+            if (__atomic_load_n(&g_threads.stop, __ATOMIC_ACQUIRE))
+                break;
+            ring_wait(&g_threads.pending, &g_threads.stop);
+            continue;
+        }
+
+        io_execute(req);
+
+        ring_push(&g_threads.done, req);
+        ring_wake(&g_threads.done);
+    }
+    return NULL;
+}
+
+void threads_stop(void)
+{
+    unsigned int i;
+
+    __atomic_store_n(&g_threads.stop, 1, __ATOMIC_RELEASE);
+    pthread_mutex_lock(&g_threads.pending.mutex);
+    pthread_cond_broadcast(&g_threads.pending.cond);
+    pthread_mutex_unlock(&g_threads.pending.mutex);
+
+    for (i = 0; i < g_threads.threads_size; ++i)
+        pthread_join(g_threads.threads[i], NULL);
+
+    free(g_threads.threads);
+    free(g_threads.batch);
+    free(g_threads.reaped);
+    ring_free(&g_threads.pending);
+    ring_free(&g_threads.done);
+    g_threads.threads = NULL;
+    g_threads.threads_size = 0;
+}
+
+int threads_start(unsigned int depth)
+{
+    unsigned int i;
+
+    memset(&g_threads, 0, sizeof(g_threads));
+    ring_init(&g_threads.pending, depth);
+    ring_init(&g_threads.done, depth);
+    g_threads.batch = (struct io_request**)malloc(
+        depth * sizeof(struct io_request*));
+    g_threads.reaped = (struct io_request**)malloc(
+        depth * sizeof(struct io_request*));
+    g_threads.threads = (pthread_t*)malloc(depth * sizeof(pthread_t));
+    if (!g_threads.batch || !g_threads.reaped || !g_threads.threads)
+        return 0;
+
+    for (i = 0; i < depth; ++i) {
+        if (pthread_create(&g_threads.threads[i], NULL, threads_run, NULL) != 0)
+            break;
+    }
+    g_threads.threads_size = i;
+    if (i != depth) {
+        threads_stop();
+        return 0;
+    }
+    return 1;
+}
+
+/* publish the submitted batch and wake the I/O threads once */
+void threads_flush(void)
+{
+    unsigned int i;
+
+    if (g_threads.batch_size == 0) return;
+    for (i = 0; i < g_threads.batch_size; ++i)
+        ring_push(&g_threads.pending, g_threads.batch[i]);
+    g_threads.batch_size = 0;
+    ring_wake(&g_threads.pending);
+}
+
+void threads_submit(struct io_request* req)
+{
+    g_threads.batch[g_threads.batch_size++] = req;
+    g_threads.outstanding++;
+}
+
+struct io_request* threads_reap(void)
+{
+    struct io_request* req;
+    unsigned int pending, done;
+
+    threads_flush();
+
+    if (g_threads.reaped_pos == g_threads.reaped_size)
+    {
+        /* sample where the requests are before waiting for the next */
+        pending = ring_size(&g_threads.pending);
+        done = ring_size(&g_threads.done);
+        if (pending + done > g_threads.outstanding)
+            done = g_threads.outstanding - pending;
+        g_threads.samples++;
+        g_threads.pending_sum += pending;
+        g_threads.done_sum += done;
+        g_threads.executing_sum += g_threads.outstanding - pending - done;
+
+        /* take all completions available at once */
+        g_threads.reaped_pos = g_threads.reaped_size = 0;
+        while (g_threads.reaped_size == 0)
+        {
+            while ((req = ring_pop(&g_threads.done)) != NULL)
+                g_threads.reaped[g_threads.reaped_size++] = req;
+            if (g_threads.reaped_size == 0)
+                ring_wait(&g_threads.done, NULL);
+        }
+    }
+    g_threads.outstanding--;
+    return g_threads.reaped[g_threads.reaped_pos++];
+}
+
+/* print the average queue occupancy and waits since the last report, which
+ * shows whether the I/O threads or the main thread is the bottleneck */
+void threads_report(const char* phase)
+{
+    double n = (double)g_threads.samples;
+    double pending, executing, done;
+
+    if (g_threads.samples == 0) return;
+
+    pending = g_threads.pending_sum / n;
+    executing = g_threads.executing_sum / n;
+    done = g_threads.done_sum / n;
+
+    printf("%s phase queues of depth %u: %.2f submitted, %.2f executing, "
+           "%.2f completed on average, %s.\n", phase, g_queue_depth,
+           pending, executing, done,
+           done > executing && done > pending ?
+           "generate and verify in the main thread is the bottleneck" :
+           pending > executing ?
+           "dispatch to the I/O threads is the bottleneck" :
+           "I/O is the bottleneck");
+    printf("%s phase waits: I/O threads %"PRIu64" spinning, %"PRIu64
+           " blocked; main thread %"PRIu64" spinning, %"PRIu64" blocked.\n",
+           phase, g_threads.pending.spins, g_threads.pending.blocks,
+           g_threads.done.spins, g_threads.done.blocks);
+
+    g_threads.samples = 0;
+    g_threads.pending_sum = g_threads.executing_sum = g_threads.done_sum = 0;
+    g_threads.pending.spins = g_threads.pending.blocks = 0;
+    g_threads.done.spins = g_threads.done.blocks = 0;
+}
+
+const struct io_engine g_engine_threads = {
+    "threads", threads_start, threads_stop, threads_submit, threads_reap,
+    threads_report
+};
+
+#endif /* HAVE_PTHREAD */
+
+#if HAVE_AIO
+
+/* The aio engine uses Linux native AIO through io_submit() and
+ * io_getevents(), called as raw system calls so that libaio is not needed.
+ * It gives queue depth on kernels where io_uring is unavailable. AIO is only
+ * asynchronous with O_DIRECT on real file descriptors, so it needs the posix
+ * backend and enables -D. Submissions are collected and issued with one
+ * io_submit() when the main thread reaps. */
+
+struct aio_engine {
+    aio_context_t ctx;
+    struct iocb* iocbs;        /* one per request of the pool */
+    struct iocb** batch;       /* submitted, not yet passed to io_submit() */
+    unsigned int batch_size;
+    struct io_event* events;   /* completions fetched, not yet returned */
+    unsigned int events_pos, events_size;
+    unsigned int inflight;     /* passed to io_submit(), not yet fetched */
+    unsigned int depth;
+};
+
+struct aio_engine g_aio;
+
+int aio_start(unsigned int depth)
+{
+    memset(&g_aio, 0, sizeof(g_aio));
+    g_aio.depth = depth;
+    g_aio.iocbs = (struct iocb*)calloc(depth, sizeof(struct iocb));
+    g_aio.batch = (struct iocb**)malloc(depth * sizeof(struct iocb*));
+    g_aio.events = (struct io_event*)malloc(depth * sizeof(struct io_event));
+    if (!g_aio.iocbs || !g_aio.batch || !g_aio.events)
+        return 0;
+    return syscall(SYS_io_setup, depth, &g_aio.ctx) == 0;
+}
+
+void aio_stop(void)
+{
+    if (g_aio.ctx)
+        syscall(SYS_io_destroy, g_aio.ctx);
+    free(g_aio.iocbs);
+    free(g_aio.batch);
+    free(g_aio.events);
+    memset(&g_aio, 0, sizeof(g_aio));
+}
+
+void aio_submit(struct io_request* req)
+{
+    struct iocb* cb = &g_aio.iocbs[req - g_requests];
+
+    memset(cb, 0, sizeof(*cb));
+    cb->aio_data = (uint64_t)(uintptr_t)req;
+    cb->aio_lio_opcode = req->dir == DIR_WRITE ?
+        IOCB_CMD_PWRITE : IOCB_CMD_PREAD;
+    cb->aio_fildes = req->fh;
+    cb->aio_buf = (uint64_t)(uintptr_t)(req->buf + req->done);
+    cb->aio_nbytes = req->size - req->done;
+    cb->aio_offset = (int64_t)(req->offset + req->done);
+    g_aio.batch[g_aio.batch_size++] = cb;
+}
+
+/* wait for at least one completion and append the fetched ones to the
+ * events not yet returned, which are moved to the front of the buffer */
+void aio_getevents(void)
+{
+    unsigned int pending = g_aio.events_size - g_aio.events_pos;
+    long r;
+
+    memmove(g_aio.events, g_aio.events + g_aio.events_pos,
+            pending * sizeof(struct io_event));
+    g_aio.events_pos = 0;
+    g_aio.events_size = pending;
+
+    do {
+        r = syscall(SYS_io_getevents, g_aio.ctx, 1L,
+                    (long)(g_aio.depth - pending),
+                    g_aio.events + pending, NULL);
+    } while (r < 0 && errno == EINTR);
+
+    if (r < 0) {
+        printf("Error waiting for I/O completions with io_getevents(): "
+               "%s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    g_aio.events_size += (unsigned int)r;
+    g_aio.inflight -= (unsigned int)r;
+}
+
+/* pass the collected submissions to the kernel */
+void aio_flush(void)
+{
+    unsigned int i = 0;
+    double now = timestamp();
+    long r;
+
+    /* latency is measured from io_submit(), kept in the request meanwhile */
+    for (i = 0; i < g_aio.batch_size; ++i)
+        ((struct io_request*)(uintptr_t)g_aio.batch[i]->aio_data)->latency = now;
+
+    i = 0;
+    while (i < g_aio.batch_size)
+    {
+        r = syscall(SYS_io_submit, g_aio.ctx, (long)(g_aio.batch_size - i),
+                    g_aio.batch + i);
+        if (r > 0) {
+            i += r;
+            g_aio.inflight += (unsigned int)r;
+        }
+        else if (r < 0 && errno == EINTR) {
+            continue;
+        }
+        else if (r < 0 && errno == EAGAIN && g_aio.inflight > 0) {
+            /* the ring is full, free a slot by fetching a completion */
+            aio_getevents();
+        }
+        else {
+            /* the request cannot be submitted, which is fatal */
+            struct io_request* req =
+                (struct io_request*)(uintptr_t)g_aio.batch[i]->aio_data;
+            printf("Error submitting %s request with io_submit(): %s\n",
+                   req->dir == DIR_WRITE ? "write" : "read", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+    }
+    g_aio.batch_size = 0;
+}
+
+struct io_request* aio_reap(void)
+{
+    struct io_event* ev;
+    struct io_request* req;
+
+    aio_flush();
+
+    if (g_aio.events_pos == g_aio.events_size)
+        aio_getevents();
+
+    ev = &g_aio.events[g_aio.events_pos++];
+    req = (struct io_request*)(uintptr_t)ev->data;
+    if (ev->res < 0) {
+        req->result = -1;
+        req->error = (int)-ev->res;
+    }
+    else {
+        req->result = (ssize_t)ev->res;
+        req->error = 0;
+    }
+    req->latency = timestamp() - req->latency;
+    return req;
+}
+
+const struct io_engine g_engine_aio = {
+    "aio", aio_start, aio_stop, aio_submit, aio_reap, NULL
+};
+
+#endif /* HAVE_AIO */
+
+/* current I/O engine */
+const struct io_engine* g_engine = &g_engine_sync;
+
+/* select the engine and allocate the request pool for the current block size
+ * and queue depth, which is limited to the number of blocks per file */
+void engine_start(void)
+{
+    uint64_t file_bytes = (uint64_t)gopt_file_size * 1024 * 1024;
+    uint64_t blocks = (file_bytes + gopt_block_size - 1) / gopt_block_size;
+    const char* name = gopt_engine;
+    unsigned int i;
+
+    g_queue_depth = gopt_queue_depth;
+    if (blocks != 0 && g_queue_depth > blocks)
+        g_queue_depth = (unsigned int)blocks;
+
+    if (!name)
+        name = g_queue_depth > 1 ? "threads" : "sync";
+
+    if (strcmp(name, "sync") == 0) {
+        g_engine = &g_engine_sync;
+    }
+#if HAVE_PTHREAD
+    else if (strcmp(name, "threads") == 0) {
+        g_engine = &g_engine_threads;
+    }
+#endif
+#if HAVE_AIO
+    else if (strcmp(name, "aio") == 0) {
+        g_engine = &g_engine_aio;
+        if (g_backend != &g_backend_posix) {
+            printf("The aio engine needs the posix backend.\n");
+            exit(EXIT_FAILURE);
+        }
+        /* without O_DIRECT io_submit() blocks until the I/O is done */
+        if (!gopt_direct && O_DIRECT != 0) {
+            printf("The aio engine needs direct I/O, enabling -D.\n");
+            gopt_direct = 1;
+            gopt_dontcache = 0;
+        }
+    }
+#endif
+    else {
+        printf("Unknown or unsupported I/O engine %s, use sync, threads "
+               "or aio.\n", name);
+        exit(EXIT_FAILURE);
+    }
+
+    g_requests = (struct io_request*)calloc(g_queue_depth,
+                                            sizeof(struct io_request));
+    if (!g_requests) {
+        printf("Out of memory for I/O requests.\n");
+        exit(EXIT_FAILURE);
+    }
+    arena_reserve((g_queue_depth + 1 + 2 * gopt_verify_threads) *
+                  ((gopt_block_size + BLOCK_ALIGN - 1) & ~(size_t)(BLOCK_ALIGN - 1)));
+    g_requests_free = NULL;
+    for (i = 0; i < g_queue_depth; ++i) {
+        g_requests[i].buf = (char*)arena_alloc(gopt_block_size);
+        g_requests[i].next = g_requests_free;
+        g_requests_free = &g_requests[i];
+    }
+    g_expect = (item_type*)arena_alloc(gopt_block_size);
+    g_verify_bufs = (char*)arena_alloc(2 * gopt_verify_threads * gopt_block_size);
+
+    if (!g_engine->start(g_queue_depth)) {
+        printf("Error starting I/O engine %s with depth %u: %s\n",
+               g_engine->name, g_queue_depth, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* stop the engine and free the request pool, the buffers stay in the arena */
+void engine_stop(void)
+{
+    g_engine->stop();
+    free(g_requests);
+    g_requests = g_requests_free = NULL;
+    g_expect = NULL;
+}
+
+/* take a free request from the pool */
+struct io_request* request_get(void)
+{
+    struct io_request* req = g_requests_free;
+    g_requests_free = req->next;
+    return req;
+}
+
+/* return a completed request to the pool */
+void request_put(struct io_request* req)
+{
+    req->next = g_requests_free;
+    g_requests_free = req;
+}
+
+/* submit the remaining part of a request to the engine */
+void request_submit(struct io_request* req)
+{
+    PROBE4(block__submit, g_stats->filenum, req->offset + req->done,
+           req->size - req->done, req->dir);
+    g_engine->submit(req);
+}
+
+/* reap the next completed request from the engine */
+struct io_request* request_reap(void)
+{
+    struct io_request* req = g_engine->reap();
+    PROBE5(block__complete, g_stats->filenum, req->offset + req->done,
+           (long)req->result, (uint64_t)(req->latency * 1e9), req->dir);
+    return req;
+}
+
+/* request sizes and queue depths of the sweep grid */
+size_t g_sweep_sizes[16] = {
+    4096, 16384, 65536, 262144, 1048576, 4194304, 16777216
+};
+unsigned int g_sweep_sizes_size = 7;
+unsigned int g_sweep_depths[16] = { 1, 4, 16, 64, 256 };
+unsigned int g_sweep_depths_size = 5;
+
+/* run the sweep grid */
+int gopt_sweep = 0;
+
+/* parse sweep grid sizes[:depths], both comma separated lists */
+void sweep_parse(const char* spec)
+{
+    const char* p = spec;
+    unsigned int n = 0;
+
+    while (*p && *p != ':' && n < 16) {
+        g_sweep_sizes[n] = (size_t)parse_size(p, &p);
+        if (g_sweep_sizes[n] == 0 || g_sweep_sizes[n] % BLOCK_ALIGN != 0)
+            break;
+        ++n;
+        if (*p == ',') ++p;
+    }
+    if (n == 0 || (*p && *p != ':')) {
+        printf("Invalid sweep request sizes %s, use multiples of 4k.\n", spec);
+        exit(EXIT_FAILURE);
+    }
+    g_sweep_sizes_size = n;
+
+    if (*p != ':') return;
+    ++p, n = 0;
+    while (*p && n < 16) {
+        char* e;
+        g_sweep_depths[n] = (unsigned int)strtoul(p, &e, 10);
+        if (e == p || g_sweep_depths[n] == 0)
+            break;
+        ++n, p = e;
+        if (*p == ',') ++p;
+    }
+    if (n == 0 || *p) {
+        printf("Invalid sweep queue depths %s.\n", spec);
+        exit(EXIT_FAILURE);
+    }
+    g_sweep_depths_size = n;
+}
+
+/******************************************************************************/
+/* Auto-tuning: before filling, write and read back a probe file with each
+ * combination of request size, queue depth and buffered or direct I/O for a
+ * share of a few seconds. The configuration with the highest combined write
+ * and verify throughput whose p99 latencies stay within the budget is used
+ * for the run. */
+
+/* seconds spent probing, 0 = no auto-tuning */
+double gopt_autotune = 0;
+
+/* maximum p99 request latency in ms accepted by the auto-tuner, 0 = any */
+double gopt_latency_budget = 0;
+
+/* a configuration probed by the auto-tuner */
+struct tune_result {
+    size_t block_size;
+    unsigned int depth;
+    int direct;
+    int ok;                  /* probe completed without errors */
+    int error;               /* errno of a failed probe, 0 for a mismatch */
+    double speed[2];         /* throughput in MiB/s by enum stats_dir */
+    double p99[2];           /* p99 request latency in seconds */
+};
+
+/* configuration chosen by the auto-tuner, block_size 0 if not run */
+struct tune_result g_tune;
+
+/* probe grid */
+const size_t g_tune_sizes[] = { 128 * 1024, 1024 * 1024, 4096 * 1024 };
+const unsigned int g_tune_depths[] = { 1, 4, 16 };
+
+/* largest probe file */
+#define TUNE_PROBE_BYTES (256 * 1024 * 1024)
+
+/* combined throughput of writing and verifying the same data */
+double tune_score(const struct tune_result* t)
+{
+    if (t->speed[DIR_WRITE] <= 0 || t->speed[DIR_READ] <= 0) return 0;
+    return 1.0 / (1.0 / t->speed[DIR_WRITE] + 1.0 / t->speed[DIR_READ]);
+}
+
+/* write and read back the probe file with the current engine for at most the
+ * given time, returns 0 on any error */
+int tune_probe(double seconds, struct tune_result* res)
+{
+    const char* filename = "disk-filltest.probe";
+    uint64_t hist[STATS_HIST_BUCKETS], count, limit = TUNE_PROBE_BYTES;
+    uint64_t pos, bytes, rnd, xn;
+    unsigned int inflight;
+    double ts, deadline;
+    int fd, dir, err = 0;
+    struct io_request* req;
+
+    fd = g_backend->open(filename, O_RDWR | O_CREAT | O_TRUNC);
+    if (fd < 0) {
+        res->error = errno;
+        return 0;
+    }
+
+    for (dir = DIR_WRITE; dir <= DIR_READ && !err; ++dir)
+    {
+        memset(hist, 0, sizeof(hist));
+        count = pos = bytes = 0;
+        inflight = 0;
+        rnd = g_seed;
+        ts = timestamp();
+        deadline = ts + seconds / 2;
+
+        while (inflight != 0 ||
+               (!err && pos < limit && timestamp() < deadline))
+        {
+            while (!err && pos < limit && inflight < g_queue_depth &&
+                   timestamp() < deadline)
+            {
+                req = request_get();
+                req->fh = fd;
+                req->dir = dir;
+                req->offset = pos;
+                req->size = gopt_block_size;
+                if (req->size > limit - pos)
+                    req->size = limit - pos;
+                req->done = 0;
+                if (dir == DIR_WRITE)
+                    fill_random_block((item_type*)req->buf,
+                                      req->size / sizeof(item_type), &rnd);
+                request_submit(req);
+                pos += req->size;
+                ++inflight;
+            }
+
+            req = request_reap();
+            --inflight;
+
+            /* the probe does not retry partial transfers */
+            if (req->result != (ssize_t)req->size) {
+                if (!err)
+                    res->error = req->result < 0 ? req->error : EIO;
+                err = 1;
+            }
+            else {
+                bytes += req->size;
+                hist[stats_lat_bucket(req->latency)]++;
+                count++;
+
+                if (dir == DIR_READ) {
+                    xn = g_seed;
+                    lcg_skip(&xn, req->offset / sizeof(item_type));
+                    fill_random_block(g_expect, req->size / sizeof(item_type),
+                                      &xn);
+                    if (compare_block((item_type*)req->buf, g_expect,
+                                      req->size / sizeof(item_type))
+                        != req->size / sizeof(item_type) && !err) {
+                        res->error = 0;
+                        err = 1;
+                    }
+                }
+            }
+            request_put(req);
+        }
+
+        res->speed[dir] = bytes / 1024.0 / 1024.0 / (timestamp() - ts);
+        res->p99[dir] = stats_lat_percentile(hist, count, 99);
+
+        /* read back what was written, from the device */
+        limit = pos;
+        if (dir == DIR_WRITE && !gopt_direct && g_backend->evict(fd) != 0) {
+            res->error = errno;
+            err = 1;
+        }
+    }
+
+    /* the cleanup may change errno, the failure is kept in res->error */
+    g_backend->close(fd);
+    g_backend->unlink(filename);
+    return !err;
+}
+
+/* probe all configurations and switch to the best one */
+void autotune(void)
+{
+    struct tune_result results[32], *best = NULL;
+    unsigned int s, d, n = 0, i;
+    int direct, directs = (g_backend == &g_backend_posix && O_DIRECT != 0 &&
+                           !gopt_mmap);
+    /* the aio engine always uses direct I/O */
+    int buffered = !(gopt_engine && strcmp(gopt_engine, "aio") == 0);
+    /* buffered probes use plain buffered I/O, not RWF_DONTCACHE */
+    int dontcache = gopt_dontcache;
+    double seconds;
+    char size[16];
+
+    for (direct = !buffered; direct <= directs; ++direct)
+        for (s = 0; s < sizeof(g_tune_sizes) / sizeof(*g_tune_sizes); ++s)
+            for (d = 0; d < sizeof(g_tune_depths) / sizeof(*g_tune_depths); ++d)
+            {
+                memset(&results[n], 0, sizeof(results[n]));
+                results[n].block_size = g_tune_sizes[s];
+                results[n].depth = g_tune_depths[d];
+                results[n].direct = direct;
+                ++n;
+            }
+
+    seconds = gopt_autotune / n;
+    printf("Auto-tuning for %.0f s over %u configurations", gopt_autotune, n);
+    if (gopt_latency_budget > 0)
+        printf(", p99 latency budget %.3f ms", gopt_latency_budget);
+    printf("\n%-8s %5s %-8s %12s %12s %12s %12s\n", "size", "depth", "I/O",
+           "write MiB/s", "verify MiB/s", "write p99", "verify p99");
+
+    for (i = 0; i < n; ++i)
+    {
+        struct tune_result* t = &results[i];
+
+        engine_stop();
+        gopt_block_size = t->block_size;
+        gopt_queue_depth = t->depth;
+        gopt_direct = t->direct;
+        gopt_dontcache = 0;
+        engine_start();
+
+        t->ok = tune_probe(seconds, t);
+
+        format_size(t->block_size, size);
+        if (!t->ok) {
+            printf("%-8s %5u %-8s failed: %s\n", size, t->depth,
+                   t->direct ? "direct" : "buffered",
+                   t->error ? strerror(t->error) : "data mismatch");
+            continue;
+        }
+        printf("%-8s %5u %-8s %12.1f %12.1f %9.3f ms %9.3f ms\n", size,
+               t->depth, t->direct ? "direct" : "buffered",
+               t->speed[DIR_WRITE], t->speed[DIR_READ],
+               t->p99[DIR_WRITE] * 1e3, t->p99[DIR_READ] * 1e3);
+    }
+
+    /* best throughput within budget, else the lowest latency */
+    for (i = 0; i < n; ++i)
+    {
+        struct tune_result* t = &results[i];
+        double p99 = t->p99[DIR_WRITE] > t->p99[DIR_READ] ?
+            t->p99[DIR_WRITE] : t->p99[DIR_READ];
+
+        if (!t->ok) continue;
+        if (gopt_latency_budget > 0 && p99 * 1e3 > gopt_latency_budget)
+            continue;
+        if (!best || tune_score(t) > tune_score(best))
+            best = t;
+    }
+    if (!best && gopt_latency_budget > 0)
+    {
+        printf("No configuration met the latency budget, "
+               "choosing the lowest p99 latency.\n");
+        for (i = 0; i < n; ++i) {
+            struct tune_result* t = &results[i];
+            if (t->ok && (!best ||
+                          t->p99[DIR_WRITE] + t->p99[DIR_READ] <
+                          best->p99[DIR_WRITE] + best->p99[DIR_READ]))
+                best = t;
+        }
+    }
+    if (!best) {
+        printf("Auto-tuning failed, all probes failed.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    g_tune = *best;
+    engine_stop();
+    gopt_block_size = g_tune.block_size;
+    gopt_queue_depth = g_tune.depth;
+    gopt_direct = g_tune.direct;
+    gopt_dontcache = dontcache && !g_tune.direct;
+    engine_start();
+
+    format_size(g_tune.block_size, size);
+    printf("Auto-tuning chose request size %s, queue depth %u, %s I/O: "
+           "write %.1f MiB/s, verify %.1f MiB/s.\n", size, g_queue_depth,
+           g_tune.direct ? "direct" : "buffered",
+           g_tune.speed[DIR_WRITE], g_tune.speed[DIR_READ]);
+}
+
+/******************************************************************************/
+/* Extent fragmentation of the files.
+ *
+ * With --extents the extents of each file are counted with the FIEMAP ioctl
+ * after its throughput was measured, and shown next to it. A file which the
+ * file system scattered over many small extents is slow on any disk, so at
+ * the end of each phase the files clearly slower than the median file are
+ * listed with a verdict: explained by fragmentation if they have clearly more
+ * and smaller extents than the median file, otherwise the slowness lies with
+ * the device. */
+
+/* count the extents of each file */
+int gopt_extents = 0;
+
+/* files slower than this fraction of the median speed are examined */
+#define EXTENTS_SLOW 0.8
+
+/* a slow file is fragmented with more than this multiple of the median
+ * extent count ... */
+#define EXTENTS_MANY 2
+
+/* ... and an average extent below this size, beyond which the seeks between
+ * extents cost little compared to the transfer */
+#define EXTENTS_SMALL (16 * 1024 * 1024)
+
+/* extent layout of a file, count is 0 if unknown */
+struct extent_info {
+    uint64_t count;
+    uint64_t bytes;
+};
+
+/* file measured in the current phase */
+struct extent_file {
+    unsigned int file;
+    double speed;
+    struct extent_info ext;
+};
+
+struct extent_file* g_extent_files = NULL;
+unsigned int g_extent_files_size = 0, g_extent_files_cap = 0;
+
+/* count the extents of a file by handle or, if fd is negative, by name.
+ * Delayed allocations are flushed first if sync is set. */
+void extents_measure(const char* filename, int fd, uint64_t bytes, int sync,
+                     struct extent_info* ext)
+{
+#if HAVE_FIEMAP
+    struct fiemap fm;
+    int own = 0;
+#endif
+
+    ext->count = 0;
+    ext->bytes = bytes;
+    if (!gopt_extents || g_backend != &g_backend_posix) return;
+
+#if HAVE_FIEMAP
+    if (fd < 0) {
+        if (filename == NULL) return;
+        fd = open(filename, O_RDONLY);
+        if (fd < 0) return;
+        own = 1;
+    }
+
+    /* with no room for extents the kernel only counts them */
+    memset(&fm, 0, sizeof(fm));
+    fm.fm_start = 0;
+    fm.fm_length = FIEMAP_MAX_OFFSET;
+    fm.fm_flags = sync ? FIEMAP_FLAG_SYNC : 0;
+    fm.fm_extent_count = 0;
+    if (ioctl(fd, FS_IOC_FIEMAP, &fm) == 0)
+        ext->count = fm.fm_mapped_extents;
+
+    if (own) close(fd);
+#else
+    (void)filename;
+    (void)fd;
+    (void)sync;
+#endif
+}
+
+/* average extent size in MiB */
+double extents_avg(const struct extent_info* ext)
+{
+    return ext->count ? ext->bytes / 1024.0 / 1024.0 / ext->count : 0;
+}
+
+/* describe the extents of a file for its throughput line */
+const char* extents_format(const struct extent_info* ext)
+{
+    static char buf[64];
+
+    if (ext->count == 0) return "";
+    snprintf(buf, sizeof(buf), ", %"PRIu64" extent%s of avg %.1f MiB",
+             ext->count, ext->count == 1 ? "" : "s", extents_avg(ext));
+    return buf;
+}
+
+/* remember the speed and extents of a file for the phase summary */
+void extents_record(unsigned int file, double speed,
+                    const struct extent_info* ext)
+{
+    if (ext->count == 0) return;
+
+    if (g_extent_files_size == g_extent_files_cap) {
+        g_extent_files_cap = g_extent_files_cap ? 2 * g_extent_files_cap : 256;
+        g_extent_files = (struct extent_file*)realloc(
+            g_extent_files, g_extent_files_cap * sizeof(struct extent_file));
+        if (g_extent_files == NULL) {
+            printf("Out of memory for extent records.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    g_extent_files[g_extent_files_size].file = file;
+    g_extent_files[g_extent_files_size].speed = speed;
+    g_extent_files[g_extent_files_size].ext = *ext;
+    ++g_extent_files_size;
+}
+
+/* ascending order of doubles for qsort() */
+int extents_cmp(const void* a, const void* b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+    return x < y ? -1 : x > y ? 1 : 0;
+}
+
+/* median of n values, reordering them */
+double extents_median(double* v, unsigned int n)
+{
+    qsort(v, n, sizeof(double), extents_cmp);
+    return n % 2 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+}
+
+/* list the slow files of a phase and whether fragmentation explains them,
+ * then forget the files */
+void extents_summary(const char* phase)
+{
+    double *v, speed, count;
+    unsigned int i, slow = 0;
+
+    if (g_extent_files_size == 0) return;
+
+    v = (double*)malloc(g_extent_files_size * sizeof(double));
+    if (v == NULL) {
+        printf("Out of memory for extent records.\n");
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < g_extent_files_size; ++i)
+        v[i] = g_extent_files[i].speed;
+    speed = extents_median(v, g_extent_files_size);
+    for (i = 0; i < g_extent_files_size; ++i)
+        v[i] = (double)g_extent_files[i].ext.count;
+    count = extents_median(v, g_extent_files_size);
+    free(v);
+
+    printf("%s extents: median file %.1f extents at %.1f MiB/s.\n",
+           phase, count, speed);
+
+    for (i = 0; i < g_extent_files_size; ++i)
+    {
+        const struct extent_file* ef = &g_extent_files[i];
+
+        if (ef->speed >= EXTENTS_SLOW * speed) continue;
+        ++slow;
+
+        printf("  random-%08u with %.1f MiB/s (%.0f%% of median)%s: ",
+               ef->file, ef->speed, 100.0 * ef->speed / speed,
+               extents_format(&ef->ext));
+        if (ef->ext.count > EXTENTS_MANY * count &&
+            ef->ext.bytes < ef->ext.count * (uint64_t)EXTENTS_SMALL)
+            printf("slowness explained by fragmentation.\n");
+        else
+            printf("not fragmented, slowness lies with the device.\n");
+    }
+    if (slow == 0) {
+        printf("  No file slower than %.0f%% of the median.\n",
+               100 * EXTENTS_SLOW);
+    }
+
+    g_extent_files_size = 0;
+}
+
+/******************************************************************************/
+/* Run report and baseline comparison.
+ *
+ * With --json the throughput and latency of every file, which is a region of
+ * the disk filled in order, is written to a line-oriented JSON report together
+ * with the device identity. With --baseline a report of a previous run on the
+ * same device is loaded and each region is compared to its counterpart. A
+ * paired t-test over all regions decides if a slowdown is significant, and a
+ * significant slowdown beyond --regress-threshold ends the program with exit
+ * code EXIT_REGRESSION. */
+
+#define EXIT_REGRESSION 3
+
+/* measurement of one file in one phase */
+struct report_file {
+    int dir;                 /* enum stats_dir */
+    unsigned int repeat, file;
+    uint64_t bytes;
+    double seconds;
+    double lat_avg, lat_p50, lat_p99; /* request latencies in seconds */
+    uint64_t extents;        /* 0 if not counted */
+};
+
+struct report {
+    struct report_file* files;
+    unsigned int files_size, files_cap;
+    /* device identity */
+    char dev[32], name[64], model[128], serial[128];
+};
+
+/* records of the current run and of the loaded baseline */
+struct report g_report, g_baseline;
+
+/* write report to this file */
+const char* gopt_json = NULL;
+
+/* compare to report in this file */
+const char* gopt_baseline = NULL;
+
+/* throughput or latency change in percent counted as regression */
+double gopt_regress_threshold = 10.0;
+
+/* latency histogram at start of the current file */
+uint64_t g_report_hist[STATS_HIST_BUCKETS];
+uint64_t g_report_count;
+double g_report_sum;
+
+/* identify the block device holding the current directory via sysfs */
+void device_identify(struct report* rp)
+{
+    static const char* serial_attrs[] = {
+        "serial", "device/serial", "device/vpd_pg80", "device/wwid", "wwid",
+        NULL
+    };
+#if HAVE_SYSFS
+    char dir[PATH_MAX];
+    const char* base;
+    int i;
+
+    if (g_backend != &g_backend_posix) {
+        snprintf(rp->name, sizeof(rp->name), "%s", g_backend->name);
+        return;
+    }
+    if (!sysfs_block_dir(rp->dev, sizeof(rp->dev), dir)) return;
+
+    base = strrchr(dir, '/');
+    snprintf(rp->name, sizeof(rp->name), "%s", base ? base + 1 : dir);
+    sysfs_read(dir, "device/model", rp->model, sizeof(rp->model));
+
+    for (i = 0; serial_attrs[i]; ++i) {
+        if (sysfs_read(dir, serial_attrs[i], rp->serial, sizeof(rp->serial)))
+            break;
+    }
+#else
+    (void)serial_attrs;
+    snprintf(rp->name, sizeof(rp->name), "%s", g_backend->name);
+#endif
+}
+
+/* append a file record to a report */
+void report_append(struct report* rp, const struct report_file* rf)
+{
+    if (rp->files_size == rp->files_cap) {
+        rp->files_cap = rp->files_cap ? 2 * rp->files_cap : 256;
+        rp->files = (struct report_file*)realloc(
+            rp->files, rp->files_cap * sizeof(struct report_file));
+        if (rp->files == NULL) {
+            printf("Out of memory for report records.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    rp->files[rp->files_size++] = *rf;
+}
+
+/* remember the latency histogram before a file is processed */
+void report_file_begin(enum stats_dir dir)
+{
+    memcpy(g_report_hist, g_stats->lat_hist[dir], sizeof(g_report_hist));
+    g_report_count = g_stats->lat_count[dir];
+    g_report_sum = g_stats->lat_sum[dir];
+}
+
+/* record throughput and latency percentiles of a file from its histogram */
+void report_file_add(enum stats_dir dir, unsigned int file, uint64_t bytes,
+                     double seconds, const uint64_t hist[STATS_HIST_BUCKETS],
+                     uint64_t count, double lat_sum,
+                     const struct extent_info* ext)
+{
+    struct report_file rf;
+
+    if (!gopt_json && !gopt_baseline) return;
+
+    rf.dir = dir;
+    rf.repeat = g_stats->repeat;
+    rf.file = file;
+    rf.bytes = bytes;
+    rf.seconds = seconds;
+    rf.lat_avg = count ? lat_sum / count : 0;
+    rf.lat_p50 = stats_lat_percentile(hist, count, 50);
+    rf.lat_p99 = stats_lat_percentile(hist, count, 99);
+    rf.extents = ext->count;
+    report_append(&g_report, &rf);
+}
+
+/* record throughput and latency percentiles of a finished file */
+void report_file_end(enum stats_dir dir, uint64_t bytes, double seconds,
+                     const struct extent_info* ext)
+{
+    uint64_t hist[STATS_HIST_BUCKETS];
+    unsigned int b;
+
+    for (b = 0; b < STATS_HIST_BUCKETS; ++b)
+        hist[b] = g_stats->lat_hist[dir][b] - g_report_hist[b];
+
+    report_file_add(dir, g_stats->filenum, bytes, seconds, hist,
+                    g_stats->lat_count[dir] - g_report_count,
+                    g_stats->lat_sum[dir] - g_report_sum, ext);
+}
+
+/* throughput of a file record in MiB/s */
+double report_speed(const struct report_file* rf)
+{
+    return rf->seconds > 0 ? rf->bytes / 1024.0 / 1024.0 / rf->seconds : 0;
+}
+
+/* write the report of the current run */
+void report_write(const char* path)
+{
+    FILE* f = fopen(path, "w");
+    unsigned int i;
+
+    if (f == NULL) {
+        printf("Error writing report %s: %s\n", path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    fprintf(f, "{\n");
+    fprintf(f, "\"version\": \"%s\",\n", VERSION);
+    fprintf(f, "\"time\": %.0f,\n", g_stats->start_time);
+    fprintf(f, "\"seed\": %u,\n", g_seed);
+    fprintf(f, "\"file_size_mib\": %u,\n", gopt_file_size);
+    fprintf(f, "\"block_size\": %u,\n", (unsigned)gopt_block_size);
+    fprintf(f, "\"queue_depth\": %u,\n", g_queue_depth);
+    fprintf(f, "\"direct\": %d,\n", gopt_direct);
+    fprintf(f, "\"io_mode\": \"%s\",\n", io_mode_name());
+    fprintf(f, "\"arena\": { \"bytes\": %lu, \"pages\": \"%s\", "
+            "\"huge_bytes\": %lu },\n", (unsigned long)g_arena.size,
+            g_arena_names[g_arena.kind], (unsigned long)g_arena.huge);
+    fprintf(f, "\"numa_node\": %d,\n", g_numa.node);
+    if (g_tune.block_size != 0)
+        fprintf(f, "\"autotune\": { \"seconds\": %.1f, "
+                "\"latency_budget_ms\": %.3f, \"block_size\": %u, "
+                "\"queue_depth\": %u, \"io\": \"%s\", "
+                "\"write_mib_s\": %.3f, \"verify_mib_s\": %.3f, "
+                "\"write_p99_ms\": %.6f, \"verify_p99_ms\": %.6f },\n",
+                gopt_autotune, gopt_latency_budget,
+                (unsigned)g_tune.block_size, g_tune.depth,
+                g_tune.direct ? "direct" : "buffered",
+                g_tune.speed[DIR_WRITE], g_tune.speed[DIR_READ],
+                g_tune.p99[DIR_WRITE] * 1e3, g_tune.p99[DIR_READ] * 1e3);
+    fprintf(f, "\"backend\": \"%s\",\n", g_backend->name);
+    fprintf(f, "\"device\": { \"dev\": \"%s\", \"name\": \"%s\", "
+            "\"model\": \"%s\", \"serial\": \"%s\" },\n",
+            g_report.dev, g_report.name, g_report.model, g_report.serial);
+    fprintf(f, "\"files\": [\n");
+    for (i = 0; i < g_report.files_size; ++i) {
+        const struct report_file* rf = &g_report.files[i];
+        fprintf(f, "{ \"phase\": \"%s\", \"repeat\": %u, \"file\": %u, "
+                "\"bytes\": %"PRIu64", \"seconds\": %.6f, \"mib_s\": %.3f, "
+                "\"lat_avg_ms\": %.6f, \"lat_p50_ms\": %.6f, "
+                "\"lat_p99_ms\": %.6f, \"extents\": %"PRIu64" }%s\n",
+                rf->dir == DIR_WRITE ? "write" : "verify", rf->repeat,
+                rf->file, rf->bytes, rf->seconds, report_speed(rf),
+                rf->lat_avg * 1e3, rf->lat_p50 * 1e3, rf->lat_p99 * 1e3,
+                rf->extents, i + 1 < g_report.files_size ? "," : "");
+    }
+    fprintf(f, "]\n}\n");
+
+    if (fclose(f) != 0) {
+        printf("Error writing report %s: %s\n", path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* find a "key": value in a line and return the start of the value */
+const char* json_find(const char* line, const char* key)
+{
+    char pattern[64];
+    const char* p;
+
+    snprintf(pattern, sizeof(pattern), "\"%s\":", key);
+    if ((p = strstr(line, pattern)) == NULL) return NULL;
+    p += strlen(pattern);
+    while (*p == ' ') ++p;
+    return p;
+}
+
+/* parse a number value of key, returns 0 if missing */
+int json_number(const char* line, const char* key, double* out)
+{
+    const char* p = json_find(line, key);
+    char* end;
+
+    if (p == NULL) return 0;
+    *out = strtod(p, &end);
+    return end != p;
+}
+
+/* parse a string value of key, returns 0 if missing */
+int json_string(const char* line, const char* key, char* out, size_t size)
+{
+    const char* p = json_find(line, key);
+    size_t n = 0;
+
+    if (p == NULL || *p != '"') return 0;
+    for (++p; *p && *p != '"' && n + 1 < size; ++p)
+        out[n++] = *p;
+    out[n] = 0;
+    return 1;
+}
+
+/* load a report written by report_write() as baseline */
+void report_load(struct report* rp, const char* path)
+{
+    FILE* f = fopen(path, "r");
+    char line[1024], phase[16];
+    double v;
+
+    if (f == NULL) {
+        printf("Error opening baseline %s: %s\n", path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    while (fgets(line, sizeof(line), f))
+    {
+        struct report_file rf;
+
+        if (json_find(line, "device")) {
+            json_string(line, "dev", rp->dev, sizeof(rp->dev));
+            json_string(line, "name", rp->name, sizeof(rp->name));
+            json_string(line, "model", rp->model, sizeof(rp->model));
+            json_string(line, "serial", rp->serial, sizeof(rp->serial));
+            continue;
+        }
+        if (!json_string(line, "phase", phase, sizeof(phase)))
+            continue;
+
+        memset(&rf, 0, sizeof(rf));
+        rf.dir = strcmp(phase, "write") == 0 ? DIR_WRITE : DIR_READ;
+        if (json_number(line, "repeat", &v)) rf.repeat = (unsigned int)v;
+        if (json_number(line, "file", &v)) rf.file = (unsigned int)v;
+        if (json_number(line, "bytes", &v)) rf.bytes = (uint64_t)v;
+        if (json_number(line, "seconds", &v)) rf.seconds = v;
+        if (json_number(line, "lat_avg_ms", &v)) rf.lat_avg = v / 1e3;
+        if (json_number(line, "lat_p50_ms", &v)) rf.lat_p50 = v / 1e3;
+        if (json_number(line, "lat_p99_ms", &v)) rf.lat_p99 = v / 1e3;
+        report_append(rp, &rf);
+    }
+    fclose(f);
+
+    if (rp->files_size == 0) {
+        printf("Baseline %s contains no file records.\n", path);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* two-sided 95% critical value of Student's t distribution */
+double t_critical(unsigned int df)
+{
+    static const double table[30] = {
+        12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+        2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+        2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+    };
+    if (df == 0) return HUGE_VAL;
+    if (df <= 30) return table[df - 1];
+    return 1.96;
+}
+
+/* compare one metric of paired regions, relative changes given in pct[],
+ * positive changes are regressions. Returns 1 if the mean change is a
+ * significant regression beyond the threshold. */
+int baseline_test(const char* what, const double* pct, unsigned int n)
+{
+    double mean = 0, var = 0, t = 0, tc;
+    unsigned int i;
+    int significant, regressed;
+
+    for (i = 0; i < n; ++i) mean += pct[i];
+    mean /= n;
+    for (i = 0; i < n; ++i) var += (pct[i] - mean) * (pct[i] - mean);
+
+    tc = t_critical(n - 1);
+    if (n >= 2) {
+        var /= n - 1;
+        t = var > 0 ? mean / sqrt(var / n) :
+            mean > 0 ? HUGE_VAL : mean < 0 ? -HUGE_VAL : 0;
+        /* one-sided: only an increase is a regression */
+        significant = (t > tc);
+    }
+    else {
+        /* a single region allows no test, rely on the threshold alone */
+        significant = 1;
+    }
+    regressed = significant && mean > gopt_regress_threshold;
+
+    printf("  %-20s %+8.1f%% over %u regions", what, mean, n);
+    if (n >= 2)
+        printf(", t = %.2f (critical %.2f)", t, tc);
+    printf(": %s\n", regressed ? "REGRESSION" :
+           significant ? "significant, within threshold" :
+           mean > 0 ? "not significant" : "no regression");
+    return regressed;
+}
+
+/* compare the current run with the baseline of one phase, returns 1 if it
+ * regressed */
+int baseline_compare_phase(enum stats_dir dir)
+{
+    unsigned int i, j, n = 0, shown = 0;
+    double *speed, *lat, *tail;
+    double p50 = 0, bp50 = 0, p99 = 0, bp99 = 0;
+    int regressed = 0;
+
+    if (g_report.files_size == 0) {
+        printf("  no regions measured.\n");
+        return 0;
+    }
+
+    speed = (double*)malloc(g_report.files_size * sizeof(double));
+    lat = (double*)malloc(g_report.files_size * sizeof(double));
+    tail = (double*)malloc(g_report.files_size * sizeof(double));
+    if (speed == NULL || lat == NULL || tail == NULL) {
+        printf("Out of memory for baseline comparison.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (i = 0; i < g_report.files_size; ++i)
+    {
+        const struct report_file* cur = &g_report.files[i];
+        const struct report_file* base = NULL;
+
+        if (cur->dir != (int)dir) continue;
+        for (j = 0; j < g_baseline.files_size; ++j) {
+            const struct report_file* b = &g_baseline.files[j];
+            if (b->dir == cur->dir && b->file == cur->file &&
+                b->repeat == cur->repeat) {
+                base = b;
+                break;
+            }
+        }
+        /* compare only regions of equal size in both runs */
+        if (base == NULL || base->bytes != cur->bytes ||
+            report_speed(base) <= 0 || report_speed(cur) <= 0)
+            continue;
+
+        speed[n] = 100.0 * (1.0 - report_speed(cur) / report_speed(base));
+        lat[n] = base->lat_avg > 0 ?
+            100.0 * (cur->lat_avg / base->lat_avg - 1.0) : 0;
+        tail[n] = base->lat_p99 > 0 ?
+            100.0 * (cur->lat_p99 / base->lat_p99 - 1.0) : 0;
+        p50 += cur->lat_p50, bp50 += base->lat_p50;
+        p99 += cur->lat_p99, bp99 += base->lat_p99;
+
+        if (speed[n] > gopt_regress_threshold) {
+            if (shown++ == 0)
+                printf("  regions slower than baseline by more than %.1f%%:\n",
+                       gopt_regress_threshold);
+            printf("    random-%08u repeat %u: %.1f MiB/s, baseline %.1f "
+                   "MiB/s (-%.1f%%), p99 latency %.3f ms, baseline %.3f ms\n",
+                   cur->file, cur->repeat, report_speed(cur),
+                   report_speed(base), speed[n],
+                   cur->lat_p99 * 1e3, base->lat_p99 * 1e3);
+        }
+        ++n;
+    }
+
+    if (n == 0) {
+        printf("  no regions in common with the baseline.\n");
+    }
+    else {
+        regressed |= baseline_test("throughput loss", speed, n);
+        regressed |= baseline_test("avg latency increase", lat, n);
+        regressed |= baseline_test("p99 latency increase", tail, n);
+        printf("  mean p50 latency %.3f ms, baseline %.3f ms; "
+               "mean p99 latency %.3f ms, baseline %.3f ms\n",
+               p50 / n * 1e3, bp50 / n * 1e3, p99 / n * 1e3, bp99 / n * 1e3);
+    }
+
+    free(speed);
+    free(lat);
+    free(tail);
+    return regressed;
+}
+
+/* compare the current run with the baseline, returns 1 if it regressed */
+int baseline_compare(void)
+{
+    int regressed = 0;
+
+    printf("Comparison with baseline %s (device %s, serial %s):\n",
+           gopt_baseline, g_baseline.name[0] ? g_baseline.name : "unknown",
+           g_baseline.serial[0] ? g_baseline.serial : "unknown");
+
+    printf(" write:\n");
+    regressed |= baseline_compare_phase(DIR_WRITE);
+    printf(" verify:\n");
+    regressed |= baseline_compare_phase(DIR_READ);
+
+    if (regressed)
+        printf("Performance regressed by more than %.1f%% against the "
+               "baseline.\n", gopt_regress_threshold);
+    else
+        printf("No significant regression beyond %.1f%% against the "
+               "baseline.\n", gopt_regress_threshold);
+    return regressed;
+}
+
+/* identify the device and load the baseline before the run starts */
+void report_setup(void)
+{
+    if (!gopt_json && !gopt_baseline) return;
+
+    device_identify(&g_report);
+
+    if (gopt_baseline)
+    {
+        report_load(&g_baseline, gopt_baseline);
+
+        if (strcmp(g_baseline.serial, g_report.serial) != 0) {
+            printf("Baseline %s was recorded on device serial \"%s\", "
+                   "but this is device serial \"%s\".\n", gopt_baseline,
+                   g_baseline.serial, g_report.serial);
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+/* produce nicely formatted time in seconds */
+void format_time(unsigned int sec, char output[64])
+{
+    /* maximum digits of 32-bit unsigned int are 9. */
+    if (sec >= 24 * 3600) {
+        unsigned int days = sec / (24 * 3600);
+        sec -= days * (24 * 3600);
+        unsigned int hours = sec / 3600;
+        sec -= hours * 3600;
+        unsigned int minutes = sec / 60;
+        sec -= minutes * 60;
+        sprintf(output, "%ud%uh%um%us", days, hours, minutes, sec);
+    }
+    else if (sec >= 3600) {
+        unsigned int hours = sec / 3600;
+        sec -= hours * 3600;
+        unsigned int minutes = sec / 60;
+        sec -= minutes * 60;
+        sprintf(output, "%uh%um%us", hours, minutes, sec);
+    }
+    else if (sec >= 60) {
+        unsigned int minutes = sec / 60;
+        sec -= minutes * 60;
+        sprintf(output, "%um%us", minutes, sec);
+    }
+    else {
+        sprintf(output, "%us", sec);
+    }
+}
+
+/******************************************************************************/
+/* Intra-file progress reports with exponentially smoothed throughput and an
+ * ETA based on the bytes remaining in the current phase. On a terminal the
+ * progress line is updated in place. */
+
+/* time constant of the exponentially weighted moving average in seconds */
+#define PROGRESS_EWMA_TAU 10.0
+
+struct progress {
+    uint64_t expected;   /* expected bytes in current phase, 0 if unknown */
+    double ewma;         /* smoothed throughput in bytes/s, 0 if no sample */
+    double last_time;    /* time of last sample */
+    uint64_t last_bytes; /* phase bytes at last sample */
+    double next_time;    /* time of next progress line */
+    int tty;             /* stdout is a terminal */
+    int line_active;     /* an unterminated progress line is displayed */
+};
+
+struct progress g_progress;
+
+/* clear a progress line displayed in place, before printing other lines */
+void progress_clear(void)
+{
+    if (g_progress.line_active) {
+        printf("\r\033[K");
+        g_progress.line_active = 0;
+    }
+}
+
+/* reset progress state for a new phase with expected bytes (or 0) */
+void progress_start(uint64_t expected)
+{
+    progress_clear();
+    g_progress.expected = expected;
+    g_progress.ewma = 0;
+    g_progress.last_time = timestamp();
+    g_progress.last_bytes = 0;
+    g_progress.tty = isatty(STDOUT_FILENO);
+    if (gopt_progress < 0)
+        gopt_progress = g_progress.tty ? 1.0 : 0.0;
+    g_progress.next_time = g_progress.last_time + gopt_progress;
+}
+
+/* take a throughput sample since the last one and update the moving average,
+ * weighting the sample by its duration */
+void progress_sample(void)
+{
+    double now = timestamp(), dt = now - g_progress.last_time, rate;
+
+    if (dt <= 0) return;
+
+    rate = (g_stats->phase_bytes - g_progress.last_bytes) / dt;
+    if (g_progress.ewma == 0)
+        g_progress.ewma = rate;
+    else
+        g_progress.ewma += dt / (PROGRESS_EWMA_TAU + dt)
+            * (rate - g_progress.ewma);
+
+    g_progress.last_time = now;
+    g_progress.last_bytes = g_stats->phase_bytes;
+}
+
+/* format ETA of the current phase, returns 0 if it is unknown */
+int progress_eta(char eta[64])
+{
+    if (g_progress.expected == 0 || g_progress.ewma <= 0 ||
+        g_stats->phase_bytes > g_progress.expected)
+        return 0;
+
+    format_time((g_progress.expected - g_stats->phase_bytes)
+                / g_progress.ewma, eta);
+    return 1;
+}
+
+/* called at each block boundary: print progress line if interval passed */
+void progress_tick(void)
+{
+    char eta[64];
+    double now;
+
+    if (gopt_progress <= 0) return;
+
+    now = timestamp();
+    if (now < g_progress.next_time) return;
+    g_progress.next_time = now + gopt_progress;
+
+    progress_sample();
+
+    printf("%s%s random-%08u: %.0f MiB, %.1f MiB/s",
+           g_progress.tty ? "\r" : "",
+           g_stats->phase == PHASE_WRITE ? "Writing" : "Reading",
+           g_stats->filenum, g_stats->file_bytes / 1024.0 / 1024.0,
+           g_progress.ewma / 1024.0 / 1024.0);
+    if (g_progress.expected != 0)
+        printf(", %.1f%% of phase",
+               100.0 * g_stats->phase_bytes / g_progress.expected);
+    if (progress_eta(eta))
+        printf(", eta %s", eta);
+
+    if (g_progress.tty) {
+        printf("\033[K");
+        g_progress.line_active = 1;
+    }
+    else {
+        printf("\n");
+    }
+    fflush(stdout);
+}
+
+/******************************************************************************/
+/* Signal handling: SIGUSR1 (and SIGINFO where available) request a status
+ * report at the next block boundary, SIGINT and SIGTERM stop the current phase
+ * cleanly and print a final report. */
+
+/* set by signal handler if a status report was requested */
+volatile sig_atomic_t g_status_requested = 0;
+
+/* set by signal handler to the number of the terminating signal */
+volatile sig_atomic_t g_interrupted = 0;
+
+/* signal handler for status requests */
+void signal_status(int sig)
+{
+    (void)sig;
+    g_status_requested = 1;
+}
+
+/* signal handler for termination requests */
+void signal_interrupt(int sig)
+{
+    if (g_interrupted) {
+        /* second signal: give up immediately */
+        signal(sig, SIG_DFL);
+        raise(sig);
+    }
+    g_interrupted = sig;
+}
+
+/* install a signal handler, without interrupting system calls */
+void install_signal(int sig, void (*handler)(int))
+{
+#if HAVE_SIGACTION
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    sigaction(sig, &sa, NULL);
+#else
+    signal(sig, handler);
+#endif
+}
+
+/* install all signal handlers */
+void install_signals(void)
+{
+    install_signal(SIGINT, signal_interrupt);
+    install_signal(SIGTERM, signal_interrupt);
+#ifdef SIGUSR1
+    install_signal(SIGUSR1, signal_status);
+#endif
+#ifdef SIGINFO
+    install_signal(SIGINFO, signal_status);
+#endif
+}
+
+/* print current status of phase and file with instantaneous throughput since
+ * the last status report */
+void print_status(void)
+{
+    static uint32_t last_phase = PHASE_IDLE, last_repeat = 0;
+    static uint64_t last_bytes = 0;
+    static double last_time = 0;
+
+    double now = timestamp(), elapsed, inst, avg;
+
+    progress_clear();
+
+    if (g_stats->phase != last_phase || g_stats->repeat != last_repeat ||
+        last_time < g_stats->phase_start_time) {
+        last_phase = g_stats->phase;
+        last_repeat = g_stats->repeat;
+        last_bytes = 0;
+        last_time = g_stats->phase_start_time;
+    }
+
+    elapsed = now - g_stats->phase_start_time;
+    avg = elapsed > 0 ? g_stats->phase_bytes / 1024.0 / 1024.0 / elapsed : 0;
+    inst = now > last_time
+        ? (g_stats->phase_bytes - last_bytes) / 1024.0 / 1024.0
+        / (now - last_time) : 0;
+
+    printf("Status: %s random-%08u at %.0f MiB, %.0f MiB in %.1f s, "
+           "now %.1f MiB/s, average %.1f MiB/s.\n",
+           stats_phase_name(g_stats->phase), g_stats->filenum,
+           g_stats->file_bytes / 1024.0 / 1024.0,
+           g_stats->phase_bytes / 1024.0 / 1024.0, elapsed, inst, avg);
+    stats_print_latency(g_stats, DIR_WRITE);
+    stats_print_latency(g_stats, DIR_READ);
+    fflush(stdout);
+
+    last_bytes = g_stats->phase_bytes;
+    last_time = now;
+}
+
+/* check for signals at a block boundary: print requested status reports and
+ * return nonzero if the program was interrupted */
+int check_signals(void)
+{
+    if (g_status_requested) {
+        g_status_requested = 0;
+        print_status();
+    }
+    return g_interrupted;
+}
+
+/* a list of open file handles */
+int* g_filehandle = NULL;
+unsigned int g_filehandle_size = 0;
+unsigned int g_filehandle_limit = 0;
+
+/* append to the list of open file handles */
+void filehandle_append(int fd)
+{
+    if (g_filehandle_size >= g_filehandle_limit)
+    {
+        int* new_filehandle;
+
+        g_filehandle_limit *= 2;
+        if (g_filehandle_limit < 128) g_filehandle_limit = 128;
+
+        new_filehandle = realloc(
+            g_filehandle, sizeof(int) * g_filehandle_limit);
+        if (!new_filehandle) {
+            fprintf(stderr,
+                    "Out of memory when allocating new file handle buffer.\n");
+            exit(EXIT_FAILURE);
+        }
+        g_filehandle = new_filehandle;
+    }
+
+    g_filehandle[ g_filehandle_size++ ] = fd;
+}
+
+/* print command line usage */
+void print_usage(char* argv[])
+{
+    fprintf(stderr,
+            "Usage: %s [-s seed] [-f files] [-S size] [-r] [-u] [-U] [-C dir]\n"
+            "\n"
+            "disk-filltest " VERSION " is a simple program which fills a path with random\n"
+            "data and then rereads the files to check that the random sequence was\n"
+            "correctly stored.\n"
+            "\n"
+            "Options: \n"
+            "  -b <size>         Request size, multiple of 4k (default 1m).\n"
+            "  -C <dir>          Change into given directory before starting work.\n"
+            "  -D                Use direct I/O (O_DIRECT), bypassing the page cache.\n"
+            "  -f <file number>  Only write this number of 1 GiB sized files.\n"
+            "  -j <threads>      Verify chunks of all files in parallel, 0 = all CPUs.\n"
+            "  -N                Skip verification, e.g. for just wiping a disk.\n"
+            "  -p <seconds>      Interval of progress reports within files\n"
+            "                    (default: 1 on a terminal, otherwise 0 = off).\n"
+            "  -Q <depth>        Number of requests in flight (default 1).\n"
+            "  -r                Only verify existing data files with given random seed.\n"
+            "  -R <times>        Repeat fill/test/wipe steps given number of times.\n"
+            "  -s <random seed>  Use random seed to write or verify data files.\n"
+            "  -S <size>         Size of each random file in MiB (default: 1024).\n"
+            "  -u                Remove files after successful test.\n"
+            "  -U                Immediately remove files, write and verify via file handles.\n"
+            "  -V                Print version and exit.\n"
+            "\n"
+            "Monitoring: \n"
+            "  --stats-shm[=<name>]  Publish live statistics in shared memory\n"
+            "                        (default name: /disk-filltest.<pid>).\n"
+            "  --top=<pid|name>      Display live statistics of a running instance.\n"
+            "\n"
+            "Benchmarks: \n"
+            "  --bench-kernels       Measure generator and compare kernels in memory.\n"
+            "  --bench-e2e           Run fill and verify against null, mem and tmpfs\n"
+            "                        backends (default: -f 4 -S 256).\n"
+            "  --bench=<K>           Benchmark K trials of write and verify, default\n"
+            "                        -f 4 -S 256, report mean, stddev and 95%% CI.\n"
+            "  --warmup=<N>          Unmeasured warm-up runs before trials (default 1).\n"
+            "  --sweep[=<sizes>:<depths>]  Measure a grid of request sizes and queue\n"
+            "                        depths, default -f 1 -S 64 per point and grid\n"
+            "                        4k,16k,64k,256k,1m,4m,16m:1,4,16,64,256.\n"
+            "\n"
+            "I/O backends: \n"
+            "  --backend=<name>      posix (default), tmpfs[:dir], mem[:MiB], null[:MiB]\n"
+            "  --mem-latency=<dist>  Latency of mem requests in microseconds:\n"
+            "                        const:<us>, uniform:<min>:<max> or exp:<mean>.\n"
+            "  --fault=<kind:file:offset>,...  Inject faults into the backend, kind is\n"
+            "                        eio-read, eio-write, short-read, short-write,\n"
+            "                        bitflip, zero, misplace; or enospc:<bytes>.\n"
+            "  --json=<file>         Write per-file throughput and latency report.\n"
+            "  --baseline=<file>     Compare with the report of a previous run on the\n"
+            "                        same device, exit with code 3 on regression.\n"
+            "  --regress-threshold=<pct>  Slowdown counted as regression (default 10).\n"
+            "  --io-mode=<mode>      buffered, direct (-D), dontcache (uncached buffered)\n"
+            "                        or compare: benchmark all modes side by side.\n"
+            "  --writeback-window=<size>  Write back buffered writes in windows of size.\n"
+            "  --extents             Show extent counts of the files and flag slow files\n"
+            "                        explained by fragmentation.\n"
+            "  --age=<pct>[:<size>]  Fill the volume (or size) with mixed aging files,\n"
+            "                        delete pct%% of them and compare fill and verify\n"
+            "                        into the holes with the fresh volume.\n"
+            "  --reread=<M>          Verify M times from the device, report blocks which\n"
+            "                        read back correctly once and fail later.\n"
+            "  --scrub=<MiB/s>       Re-verify the retained files forever at this rate,\n"
+            "                        needs -s of the original write on first start.\n"
+            "  --scrub-checkpoint=<file>  Scrub position (default disk-filltest.scrub).\n"
+            "  --scrub-alert=<cmd>   Run cmd with kind, file and offset on failed blocks.\n"
+            "  --engine=<name>       I/O engine: sync, threads or aio (default: sync\n"
+            "                        if depth is 1, else threads).\n"
+            "  --autotune[=<sec>]    Probe request sizes, depths and direct I/O for\n"
+            "                        some seconds (default 10), use the fastest.\n"
+            "  --latency-budget=<ms> Maximum p99 latency accepted by --autotune.\n"
+            "  --mmap                Verify files by mapping them, without copying.\n"
+            "  --hugepages=<policy>  I/O buffer pages: auto, hugetlb, thp or off.\n"
+            "  --numa=<node>         Run on NUMA node: auto (of the disk), off or number.\n"
+            "\n",
+            argv[0]);
+    exit(EXIT_FAILURE);
+}
+
+/* identifiers of long options without short equivalent */
+enum {
+    OPT_STATS_SHM = 256,
+    OPT_TOP,
+    OPT_BENCH_KERNELS,
+    OPT_BENCH_E2E,
+    OPT_BACKEND,
+    OPT_MEM_LATENCY,
+    OPT_FAULT,
+    OPT_JSON,
+    OPT_BASELINE,
+    OPT_REGRESS_THRESHOLD,
+    OPT_BENCH,
+    OPT_WARMUP,
+    OPT_ENGINE,
+    OPT_SWEEP,
+    OPT_AUTOTUNE,
+    OPT_LATENCY_BUDGET,
+    OPT_MMAP,
+    OPT_HUGEPAGES,
+    OPT_NUMA,
+    OPT_WRITEBACK_WINDOW,
+    OPT_IO_MODE,
+    OPT_EXTENTS,
+    OPT_AGE,
+    OPT_REREAD,
+    OPT_SCRUB,
+    OPT_SCRUB_CHECKPOINT,
+    OPT_SCRUB_ALERT
+};
+
+/* long command line options */
+const struct option g_long_options[] = {
+    { "stats-shm", optional_argument, NULL, OPT_STATS_SHM },
+    { "top", required_argument, NULL, OPT_TOP },
+    { "bench-kernels", no_argument, NULL, OPT_BENCH_KERNELS },
+    { "bench-e2e", no_argument, NULL, OPT_BENCH_E2E },
+    { "backend", required_argument, NULL, OPT_BACKEND },
+    { "mem-latency", required_argument, NULL, OPT_MEM_LATENCY },
+    { "fault", required_argument, NULL, OPT_FAULT },
+    { "json", required_argument, NULL, OPT_JSON },
+    { "baseline", required_argument, NULL, OPT_BASELINE },
+    { "regress-threshold", required_argument, NULL, OPT_REGRESS_THRESHOLD },
+    { "bench", required_argument, NULL, OPT_BENCH },
+    { "warmup", required_argument, NULL, OPT_WARMUP },
+    { "engine", required_argument, NULL, OPT_ENGINE },
+    { "sweep", optional_argument, NULL, OPT_SWEEP },
+    { "autotune", optional_argument, NULL, OPT_AUTOTUNE },
+    { "latency-budget", required_argument, NULL, OPT_LATENCY_BUDGET },
+    { "mmap", no_argument, NULL, OPT_MMAP },
+    { "hugepages", required_argument, NULL, OPT_HUGEPAGES },
+    { "numa", required_argument, NULL, OPT_NUMA },
+    { "writeback-window", required_argument, NULL, OPT_WRITEBACK_WINDOW },
+    { "io-mode", required_argument, NULL, OPT_IO_MODE },
+    { "extents", no_argument, NULL, OPT_EXTENTS },
+    { "age", required_argument, NULL, OPT_AGE },
+    { "reread", required_argument, NULL, OPT_REREAD },
+    { "scrub", required_argument, NULL, OPT_SCRUB },
+    { "scrub-checkpoint", required_argument, NULL, OPT_SCRUB_CHECKPOINT },
+    { "scrub-alert", required_argument, NULL, OPT_SCRUB_ALERT },
+    { NULL, 0, NULL, 0 }
+};
+
+/* parse command line parameters */
+void parse_commandline(int argc, char* argv[])
+{
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "hs:S:f:ruUC:NR:Vp:Db:Q:j:",
+                              g_long_options, NULL)) != -1) {
+        switch (opt) {
+        case 's':
+            g_seed = atoi(optarg);
+            g_seed_given = 1;
+            break;
+        case 'S':
+            gopt_file_size = atoi(optarg);
+            break;
+        case 'f':
+            gopt_file_limit = atoi(optarg);
+            break;
+        case 'r':
+            gopt_readonly = 1;
+            break;
+        case 'u':
+            gopt_unlink_after = 1;
+            break;
+        case 'U':
+            gopt_unlink_immediate = 1;
+            break;
+        case 'C':
+            if (chdir(optarg) != 0) {
+                printf("Error chdir to %s: %s\n", optarg, strerror(errno));
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'N':
+            gopt_skip_verify = 1;
+            break;
+        case 'R':
+            gopt_repeat = atoi(optarg);
+            break;
+        case 'p':
+            gopt_progress = atof(optarg);
+            break;
+        case 'D':
+            if (O_DIRECT == 0) {
+                printf("Direct I/O is not supported on this platform.\n");
+                exit(EXIT_FAILURE);
+            }
+            gopt_direct = 1;
+            break;
+        case 'b':
+            gopt_block_size = (size_t)parse_size(optarg, NULL);
+            if (gopt_block_size == 0 || gopt_block_size % BLOCK_ALIGN != 0) {
+                printf("Invalid request size %s, use a multiple of 4k.\n",
+                       optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'Q':
+            gopt_queue_depth = atoi(optarg);
+            if (gopt_queue_depth == 0)
+                gopt_queue_depth = 1;
+            break;
+        case 'j':
+            gopt_verify_threads = atoi(optarg);
+#if HAVE_PTHREAD && defined(_SC_NPROCESSORS_ONLN)
+            if (gopt_verify_threads == 0)
+                gopt_verify_threads = (unsigned int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+            if (gopt_verify_threads == 0)
+                gopt_verify_threads = 1;
+#if !HAVE_PTHREAD
+            gopt_verify_threads = 1;
+#endif
+            break;
+	case 'V':
+	    printf("disk-filltest " VERSION "\n");
+            exit(EXIT_SUCCESS);
+        case OPT_STATS_SHM:
+            gopt_stats_shm = optarg ? optarg : "";
+            break;
+        case OPT_TOP:
+            stats_top(optarg);
+            break;
+        case OPT_BENCH_KERNELS:
+            bench_kernels();
+            break;
+        case OPT_BENCH_E2E:
+            gopt_bench_e2e = 1;
+            break;
+        case OPT_BACKEND:
+            backend_select(optarg);
+            break;
+        case OPT_MEM_LATENCY:
+            mem_parse_latency(optarg);
+            break;
+        case OPT_FAULT:
+            fault_add(optarg);
+            break;
+        case OPT_JSON:
+            gopt_json = optarg;
+            break;
+        case OPT_BASELINE:
+            gopt_baseline = optarg;
+            break;
+        case OPT_REGRESS_THRESHOLD:
+            gopt_regress_threshold = atof(optarg);
+            break;
+        case OPT_BENCH:
+            gopt_bench_trials = atoi(optarg);
+            break;
+        case OPT_WARMUP:
+            gopt_bench_warmup = atoi(optarg);
+            break;
+        case OPT_ENGINE:
+            gopt_engine = optarg;
+            break;
+        case OPT_SWEEP:
+            gopt_sweep = 1;
+            if (optarg)
+                sweep_parse(optarg);
+            break;
+        case OPT_AUTOTUNE:
+            gopt_autotune = optarg ? atof(optarg) : 10;
+            break;
+        case OPT_LATENCY_BUDGET:
+            gopt_latency_budget = atof(optarg);
+            break;
+        case OPT_MMAP:
+            gopt_mmap = 1;
+            break;
+        case OPT_HUGEPAGES:
+            if (strcmp(optarg, "auto") != 0 && strcmp(optarg, "hugetlb") != 0 &&
+                strcmp(optarg, "thp") != 0 && strcmp(optarg, "off") != 0) {
+                printf("Invalid huge page policy %s, "
+                       "use auto, hugetlb, thp or off.\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            gopt_hugepages = optarg;
+            break;
+        case OPT_NUMA:
+            if (strcmp(optarg, "auto") != 0 && strcmp(optarg, "off") != 0 &&
+                strspn(optarg, "0123456789") != strlen(optarg)) {
+                printf("Invalid NUMA node %s, use auto, off or a node number.\n",
+                       optarg);
+                exit(EXIT_FAILURE);
+            }
+            gopt_numa = optarg;
+            break;
+        case OPT_IO_MODE:
+            gopt_direct = gopt_dontcache = gopt_io_compare = 0;
+            if (strcmp(optarg, "direct") == 0) {
+                if (O_DIRECT == 0) {
+                    printf("Direct I/O is not supported on this platform.\n");
+                    exit(EXIT_FAILURE);
+                }
+                gopt_direct = 1;
+            }
+            else if (strcmp(optarg, "dontcache") == 0)
+                gopt_dontcache = 1;
+            else if (strcmp(optarg, "compare") == 0)
+                gopt_io_compare = 1;
+            else if (strcmp(optarg, "buffered") != 0) {
+                printf("Invalid I/O mode %s, use buffered, direct, dontcache "
+                       "or compare.\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case OPT_EXTENTS:
+            gopt_extents = 1;
+            break;
+        case OPT_REREAD:
+            gopt_reread = atoi(optarg);
+            if (gopt_reread == 0) {
+                printf("Invalid number of read passes %s.\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case OPT_SCRUB:
+            gopt_scrub = atof(optarg);
+            if (gopt_scrub <= 0) {
+                printf("Invalid scrub rate %s, use MiB/s.\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case OPT_SCRUB_CHECKPOINT:
+            gopt_scrub_checkpoint = optarg;
+            break;
+        case OPT_SCRUB_ALERT:
+            gopt_scrub_alert = optarg;
+            break;
+        case OPT_AGE: {
+            const char* e;
+            gopt_age = (unsigned int)strtoul(optarg, (char**)&e, 10);
+            if (*e == ':')
+                gopt_age_bytes = parse_size(e + 1, &e);
+            if (gopt_age == 0 || gopt_age > 100 || *e != 0) {
+                printf("Invalid aging %s, use <percent deleted>[:<size>] "
+                       "with 1 to 100 percent.\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        }
+        case OPT_WRITEBACK_WINDOW:
+            gopt_writeback_window = parse_size(optarg, NULL);
+            if (gopt_writeback_window == 0 ||
+                gopt_writeback_window % (1024 * 1024) != 0) {
+                printf("Invalid write-back window %s, "
+                       "use a multiple of 1m.\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'h':
+        default:
+            print_usage(argv);
+        }
+    }
+
+    if (optind < argc)
+        print_usage(argv);
+
+    if (gopt_io_compare && !gopt_bench_trials)
+        gopt_bench_trials = 3;
+
+    if (gopt_bench_e2e || gopt_bench_trials) {
+        /* bounded default size for benchmarks */
+        if (gopt_file_size == 0)
+            gopt_file_size = 256;
+        if (gopt_file_limit == UINT_MAX)
+            gopt_file_limit = 4;
+    }
+    else if (gopt_sweep) {
+        /* each point of the sweep grid runs briefly */
+        if (gopt_file_size == 0)
+            gopt_file_size = 64;
+        if (gopt_file_limit == UINT_MAX)
+            gopt_file_limit = 1;
+    }
+
+    if (gopt_file_size == 0)
+        gopt_file_size = 1024;
+
+    if (gopt_mmap && gopt_verify_threads > 1) {
+        printf("Parallel verification with -j reads the files, "
+               "it cannot be combined with --mmap.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (gopt_mmap && gopt_engine && strcmp(gopt_engine, "aio") == 0) {
+        printf("The aio engine uses direct I/O, "
+               "it cannot be combined with --mmap.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    /* the end-to-end benchmark switches to the mem and null backends, whose
+     * handles are no file descriptors */
+    if (gopt_bench_e2e && gopt_engine && strcmp(gopt_engine, "aio") == 0) {
+        printf("The aio engine needs the posix backend, "
+               "it cannot be combined with --bench-e2e.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (gopt_mmap && (gopt_direct || gopt_io_compare)) {
+        printf("Verification with --mmap always uses the page cache, "
+               "it cannot be combined with -D or --io-mode=compare.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (gopt_age && (gopt_readonly || gopt_bench_trials || gopt_sweep ||
+                     gopt_bench_e2e)) {
+        printf("Aging writes and compares its own runs, it cannot be "
+               "combined with -r, --bench, --sweep or --bench-e2e.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (gopt_reread && (gopt_age || gopt_bench_trials || gopt_sweep ||
+                        gopt_bench_e2e || gopt_skip_verify)) {
+        printf("Repeated reads run their own verify passes, they cannot be "
+               "combined with -N, --age, --bench, --sweep or --bench-e2e.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (gopt_scrub && (gopt_reread || gopt_age || gopt_bench_trials ||
+                       gopt_sweep || gopt_bench_e2e || gopt_mmap ||
+                       gopt_verify_threads > 1 || gopt_unlink_immediate)) {
+        printf("Scrubbing only reads the retained files, it cannot be "
+               "combined with --reread, --age, --bench, --sweep, "
+               "--bench-e2e, --mmap, -j or -U.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (gopt_reread && (gopt_mmap || gopt_verify_threads > 1 ||
+                        gopt_unlink_immediate)) {
+        printf("Repeated reads go through the request pipeline of open "
+               "files, they cannot be combined with --mmap, -j or -U.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    /* benchmark trials must not be served from the page cache */
+    if ((gopt_bench_trials || gopt_sweep || gopt_age) && !gopt_direct)
+        gopt_evict = 1;
+
+    if (g_fault.faults_size != 0)
+        fault_install();
+
+    if (gopt_writeback_window && (gopt_direct || !g_backend->writeback)) {
+        printf("Write-back windows need buffered writes on the posix backend "
+               "on Linux, ignored.\n");
+        gopt_writeback_window = 0;
+    }
+}
+
+/* unlink old random files */
+void unlink_randfiles(void)
+{
+    unsigned int filenum = 0;
+
+    stats_phase(PHASE_UNLINK, 0);
+
+    while (filenum < UINT_MAX)
+    {
+        char filename[32];
+        sprintf(filename, "random-%08u", filenum);
+
+        if (g_backend->unlink(filename) != 0)
+            break;
+
+        if (filenum == 0)
+            printf("Removing old files .");
+        else
+            printf(".");
+        fflush(stdout);
+
+        ++filenum;
+    }
+
+    if (filenum > 0)
+        printf(" total: %u.\n", filenum);
+}
+
+/* run of missing names which ends the scan for aging files */
+#define AGE_SCAN_GAP 1024
+
+/* set while aging files of --age exist, removed when interrupted */
+int g_aging = 0;
+
+/* remove the aging files, which have gaps where they were deleted */
+unsigned int age_unlink(void)
+{
+    unsigned int file, miss = 0, count = 0;
+
+    for (file = 0; miss < AGE_SCAN_GAP && file < UINT_MAX; ++file)
+    {
+        char filename[32];
+        sprintf(filename, "age-%08u", file);
+
+        if (g_backend->unlink(filename) == 0)
+            ++count, miss = 0;
+        else
+            ++miss;
+    }
+    return count;
+}
+
+/* after an interrupt: print final report, remove files if requested, and
+ * terminate the program */
+void exit_interrupted(void)
+{
+    double elapsed = timestamp() - g_stats->start_time;
+    unsigned int i;
+
+    progress_clear();
+    printf("Interrupted by signal %d during %s of random-%08u.\n",
+           (int)g_interrupted, stats_phase_name(g_stats->phase),
+           g_stats->filenum);
+    printf("Final report: wrote %.0f MiB, verified %.0f MiB in %.1f s, "
+           "%u errors, %u mismatches.\n",
+           g_stats->bytes_written / 1024.0 / 1024.0,
+           g_stats->bytes_read / 1024.0 / 1024.0, elapsed,
+           g_stats->errors, g_stats->mismatches);
+    stats_print_latency(g_stats, DIR_WRITE);
+    stats_print_latency(g_stats, DIR_READ);
+
+    for (i = 0; i < g_filehandle_size; ++i)
+        g_backend->close(g_filehandle[i]);
+    g_filehandle_size = 0;
+
+    if (gopt_unlink_after)
+        unlink_randfiles();
+    if (g_aging)
+        printf("Removed %u aging files.\n", age_unlink());
+
+    fflush(stdout);
+    exit(128 + g_interrupted);
+}
+
+/* dirty and under write-back page cache memory in bytes from /proc/meminfo,
+ * 0 if unknown */
+uint64_t meminfo_dirty(void)
+{
+    FILE* f = fopen("/proc/meminfo", "r");
+    char line[128];
+    unsigned long kb, sum = 0;
+
+    if (f == NULL) return 0;
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "Dirty: %lu kB", &kb) == 1 ||
+            sscanf(line, "Writeback: %lu kB", &kb) == 1)
+            sum += kb;
+    }
+    fclose(f);
+    return (uint64_t)sum * 1024;
+}
+
+/* start write-back of each full window behind the written data and wait for
+ * the window before it, so at most two windows of the file are dirty */
+int writeback_advance(int fd, uint64_t written, uint64_t* wb_pos,
+                      uint64_t* dirty_max)
+{
+    uint64_t w = gopt_writeback_window, dirty;
+
+    while (*wb_pos + w <= written)
+    {
+        dirty = meminfo_dirty();
+        if (dirty > *dirty_max) *dirty_max = dirty;
+
+        if (g_backend->writeback(fd, *wb_pos, w, 0) != 0)
+            return -1;
+        if (*wb_pos >= w && g_backend->writeback(fd, *wb_pos - w, w, 1) != 0)
+            return -1;
+        *wb_pos += w;
+    }
+    return 0;
+}
+
+/* fill disk */
+void write_randfiles(void)
+{
+    unsigned int filenum = 0;
+    int done = 0;
+    unsigned int expected_file_limit = UINT_MAX;
+    uint64_t file_bytes = (uint64_t)gopt_file_size * 1024 * 1024;
+    uint64_t expected_bytes = 0, dirty_max = 0;
+    struct phase_cost cost;
+
+    if (g_backend->statfs(&expected_bytes) == 0) {
+        expected_file_limit = (expected_bytes + file_bytes - 1) / file_bytes;
+    }
+
+    if (gopt_file_limit != UINT_MAX) {
+        if (expected_file_limit == UINT_MAX ||
+            gopt_file_limit < expected_file_limit) {
+            expected_file_limit = gopt_file_limit;
+            expected_bytes = (uint64_t)gopt_file_limit * file_bytes;
+        }
+    }
+
+    printf("Writing files random-######## with seed %u\n", g_seed);
+    stats_phase(PHASE_WRITE,
+                expected_file_limit != UINT_MAX ? expected_file_limit : 0);
+    progress_start(expected_bytes);
+    cost_start(&cost);
+
+    while (!done && filenum < gopt_file_limit)
+    {
+        char filename[32], eta[64];
+        struct extent_info ext;
+        int fd;
+        unsigned int inflight = 0;
+        uint64_t wpos, wtotal, wend, wb_pos = 0;
+        double ts1, ts2, speed;
+        uint64_t rnd;
+        struct cost_mark cm;
+        struct io_request* req;
+
+        sprintf(filename, "random-%08u", filenum);
+        stats_file_begin(filenum);
+        report_file_begin(DIR_WRITE);
+
+        fd = g_backend->open(filename, O_RDWR | O_CREAT | O_TRUNC);
+        if (fd < 0) {
+            progress_clear();
+            printf("Error opening next file %s: %s\n",
+                   filename, strerror(errno));
+            stats_error(0);
+            break;
+        }
+        PROBE2(file__open, filenum, (int)DIR_WRITE);
+
+        if (gopt_unlink_immediate) {
+            if (g_backend->unlink(filename) != 0) {
+                progress_clear();
+                printf("Error unlinking opened file %s: %s\n",
+                       filename, strerror(errno));
+            }
+        }
+
+        /* reset random generator for each 1 GiB file */
+        rnd = g_seed + (++filenum);
+
+        /* wend is the end of the data written without holes, requests beyond
+         * a failed one may still succeed with a deep queue */
+        wpos = wtotal = 0;
+        wend = file_bytes;
+        ts1 = timestamp();
+
+        while (inflight != 0 || (!done && wpos < file_bytes))
+        {
+            /* generate blocks in file order and keep the queue full */
+            while (!done && wpos < file_bytes && inflight < g_queue_depth)
+            {
+                req = request_get();
+                req->fh = fd;
+                req->dir = DIR_WRITE;
+                req->offset = wpos;
+                req->size = gopt_block_size;
+                if (req->size > file_bytes - wpos)
+                    req->size = file_bytes - wpos;
+                req->done = 0;
+
+                cost_mark(&cm);
+                fill_random_block((item_type*)req->buf,
+                                  req->size / sizeof(item_type), &rnd);
+                cost_add(&cost, STAGE_GENERATE, &cm);
+
+                /* engines may perform I/O during submission */
+                request_submit(req);
+                cost_add(&cost, STAGE_IO, &cm);
+                wpos += req->size;
+                stats_inflight(++inflight);
+            }
+
+            cost_mark(&cm);
+            req = request_reap();
+            cost_add(&cost, STAGE_IO, &cm);
+            stats_inflight(--inflight);
+
+            if (req->result <= 0) {
+                if (req->offset + req->done < wend)
+                    wend = req->offset + req->done;
+                if (!done) {
+                    progress_clear();
+                    printf("Error writing next file %s: %s\n",
+                           filename, strerror(req->error));
+                    /* a full disk or file size limit ends the fill phase,
+                     * any other error is a failure */
+                    if (req->result == 0 ||
+                        (req->error != ENOSPC && req->error != EFBIG
+#ifdef EDQUOT
+                         && req->error != EDQUOT
+#endif
+                            )) {
+                        stats_error(0);
+                        g_write_failed = 1;
+                    }
+                    done = 1;
+                }
+                request_put(req);
+            }
+            else {
+                req->done += req->result;
+                wtotal += req->result;
+                stats_io_done(DIR_WRITE, req->result, req->latency);
+
+                if (req->done != req->size && !done) {
+                    /* short write, submit the rest of the block */
+                    request_submit(req);
+                    stats_inflight(++inflight);
+                }
+                else {
+                    if (req->done != req->size &&
+                        req->offset + req->done < wend)
+                        wend = req->offset + req->done;
+                    request_put(req);
+                }
+            }
+
+            /* blocks before those in flight are written, except for rare
+             * resubmitted short writes */
+            if (gopt_writeback_window && !done &&
+                wpos > (uint64_t)inflight * gopt_block_size)
+            {
+                cost_mark(&cm);
+                if (writeback_advance(fd, wpos - (uint64_t)inflight *
+                                      gopt_block_size, &wb_pos,
+                                      &dirty_max) != 0) {
+                    progress_clear();
+                    printf("Error writing back file %s: %s\n",
+                           filename, strerror(errno));
+                    stats_error(0);
+                    g_write_failed = 1;
+                    done = 1;
+                }
+                cost_add(&cost, STAGE_IO, &cm);
+            }
+
+            if (check_signals())
+                done = 1;
+            progress_tick();
+        }
+
+        /* wait for the last windows */
+        if (gopt_writeback_window && !done &&
+            g_backend->writeback(fd, 0, 0, 1) != 0) {
+            progress_clear();
+            printf("Error writing back file %s: %s\n",
+                   filename, strerror(errno));
+            stats_error(0);
+            g_write_failed = 1;
+            done = 1;
+        }
+
+        if (gopt_evict && !done && g_backend->evict(fd) != 0) {
+            progress_clear();
+            printf("Error writing back file %s: %s\n",
+                   filename, strerror(errno));
+            stats_error(0);
+            g_write_failed = 1;
+            done = 1;
+        }
+
+        if (gopt_unlink_immediate) { /* do not close file handle! */
+            filehandle_append(fd);
+        }
+        else {
+            g_backend->close(fd);
+        }
+        PROBE3(file__close, g_stats->filenum, wtotal, (int)DIR_WRITE);
+
+        ts2 = timestamp();
+        stats_file_done();
+        progress_sample();
+        progress_clear();
+
+        speed = wtotal / 1024.0 / 1024.0 / (ts2 - ts1);
+        g_last_filesize = wend < wpos ? wend : wpos;
+        /* allocate delayed extents outside of the measured time */
+        extents_measure(filename, gopt_unlink_immediate ? fd : -1, wtotal, 1,
+                        &ext);
+        extents_record(g_stats->filenum, speed, &ext);
+        report_file_end(DIR_WRITE, wtotal, ts2 - ts1, &ext);
+
+        if (progress_eta(eta)) {
+            printf("Wrote %.0f MiB random data to %s with %f MiB/s%s, "
+                   "eta %s.\n", (wtotal / 1024.0 / 1024.0), filename, speed,
+                   extents_format(&ext), eta);
+        }
+        else {
+            printf("Wrote %.0f MiB random data to %s with %f MiB/s%s.\n",
+                   (wtotal / 1024.0 / 1024.0), filename, speed,
+                   extents_format(&ext));
+        }
+        fflush(stdout);
+    }
+
+    if (g_interrupted)
+        exit_interrupted();
+
+    cost_report("Write", &cost, g_stats->phase_bytes);
+    if (g_engine->report)
+        g_engine->report("Write");
+    extents_summary("Write");
+    if (gopt_writeback_window) {
+        printf("Write-back windows of %"PRIu64" MiB: at most %"PRIu64
+               " MiB of dirty or write-back page cache system-wide.\n",
+               gopt_writeback_window / 1024 / 1024, dirty_max / 1024 / 1024);
+    }
+    phase_result_save(DIR_WRITE, &cost, g_stats->phase_bytes);
+    numa_account(DIR_WRITE, g_phase_result[DIR_WRITE].bytes,
+                 g_phase_result[DIR_WRITE].seconds);
+
+    errno = 0;
+}
+
+/* size of windows mapped by the mmap verification path, a multiple of the
+ * 2 MiB huge page size so that large page cache folios can be mapped whole */
+#define MMAP_WINDOW (32 * 1024 * 1024)
+
+/* read one byte of each page of a mapped block, so that waiting for the pages
+ * to be faulted in is measured apart from comparing them */
+void mmap_fault_in(const char* p, size_t n)
+{
+    volatile const char* v = p;
+    size_t o;
+
+    for (o = 0; o < n; o += BLOCK_ALIGN)
+        (void)v[o];
+}
+
+/* verify a file by mapping windows of it and comparing in place, without
+ * copying the data. The next window is mapped ahead, which starts its
+ * readahead, and each window is unmapped once verified. Returns 0 if the
+ * backend cannot map the file, then nothing was verified. */
+int verify_mmap(int fd, const char* filename, uint64_t limit, uint64_t rnd,
+                struct phase_cost* cost, uint64_t* rtotal, uint64_t* rend)
+{
+    uint64_t size, pos = 0, next_pos;
+    size_t len, next_len = 0, off, n, i, items;
+    const char *win, *next;
+    struct cost_mark cm;
+    double ts;
+    int stop = 0;
+
+    if (g_backend->fstat(fd, &size) != 0) return 0;
+    if (size > limit) size = limit;
+    if (size == 0) {
+        *rend = 0;
+        return 1;
+    }
+
+    cost_mark(&cm);
+    len = size < MMAP_WINDOW ? size : MMAP_WINDOW;
+    if ((win = (const char*)g_backend->map(fd, 0, &len)) == NULL)
+        return 0;
+
+    while (win)
+    {
+        /* map the next window ahead */
+        next = NULL;
+        next_pos = pos + len;
+        if (next_pos < size && !stop) {
+            next_len = size - next_pos < MMAP_WINDOW ?
+                size - next_pos : MMAP_WINDOW;
+            next = (const char*)g_backend->map(fd, next_pos, &next_len);
+            if (next == NULL) {
+                progress_clear();
+                printf("Error mapping file %s at offset %"PRIu64": %s\n",
+                       filename, next_pos, strerror(errno));
+                stats_error(0);
+                exit(EXIT_FAILURE);
+            }
+        }
+        cost_add(cost, STAGE_IO, &cm);
+
+        for (off = 0; off < len && !stop; off += n)
+        {
+            n = len - off < gopt_block_size ? len - off : gopt_block_size;
+            items = n / sizeof(item_type);
+
+            /* the request latency of a mapped block is its fault-in */
+            ts = timestamp();
+            mmap_fault_in(win + off, n);
+            ts = timestamp() - ts;
+            cost_add(cost, STAGE_IO, &cm);
+
+            i = verify_random_block((const item_type*)(win + off), items, &rnd);
+            cost_add(cost, STAGE_COMPARE, &cm);
+
+            if (i != items)
+            {
+                uint64_t fo = pos + off + i * sizeof(item_type);
+                PROBE2(verify__mismatch, g_stats->filenum, fo);
+                progress_clear();
+                printf("Mismatch to random sequence "
+                       "in file %s block %u at offset %lu "
+                       "(file offset %"PRIu64")\n",
+                       filename, (unsigned)(fo / gopt_block_size),
+                       (long unsigned)(fo % gopt_block_size), fo);
+                stats_error(1);
+                gopt_unlink_after = 0;
+                exit(EXIT_FAILURE);
+            }
+
+            stats_io_done(DIR_READ, n, ts);
+            *rtotal += n;
+
+            if (check_signals())
+                stop = 1;
+            progress_tick();
+        }
+
+        g_backend->unmap(fd, win, len);
+        cost_add(cost, STAGE_IO, &cm);
+
+        win = next;
+        pos = next_pos;
+        len = next_len;
+    }
+
+    *rend = stop ? pos : size;
+    return 1;
+}
+
+/******************************************************************************/
+/* Repeated reads with --reread: the files are verified several times, each
+ * pass read from the device instead of the page cache. A mismatch does not end
+ * the verification, instead the outcome of every block is kept across passes,
+ * so that blocks which read back correctly once and differently later are
+ * found. This is how read disturb and marginal cells show up on flash. */
+
+/* outcome of a block in the passes so far */
+#define REREAD_PASSED    1
+#define REREAD_FAILED    2
+#define REREAD_LATE      4   /* failed after passing, reported */
+#define REREAD_RECOVERED 8   /* passed after failing */
+
+struct reread_state {
+    unsigned char** files;   /* block outcomes of each file */
+    unsigned int files_size;
+    size_t blocks;           /* blocks per file */
+    unsigned int pass;       /* current pass, from 1 */
+    uint64_t pass_failed;    /* blocks failed in the current pass */
+    uint64_t pass_late;      /* ... of which passed in an earlier pass */
+    uint64_t late;           /* blocks which passed and failed later */
+    uint64_t recovered;      /* blocks which failed and passed later */
+};
+
+struct reread_state g_reread;
+
+/* record the outcome of the block at offset of a file in the current pass */
+void reread_block(unsigned int file, uint64_t offset, int ok)
+{
+    size_t block = offset / gopt_block_size;
+    unsigned char* s;
+
+    if (file >= g_reread.files_size)
+    {
+        unsigned int n = file + 64, i;
+        g_reread.files = (unsigned char**)realloc(
+            g_reread.files, n * sizeof(unsigned char*));
+        if (g_reread.files == NULL) {
+            printf("Out of memory for block outcomes.\n");
+            exit(EXIT_FAILURE);
+        }
+        for (i = g_reread.files_size; i < n; ++i)
+            g_reread.files[i] = NULL;
+        g_reread.files_size = n;
+    }
+    if (g_reread.files[file] == NULL)
+    {
+        g_reread.blocks = ((uint64_t)gopt_file_size * 1024 * 1024 +
+                           gopt_block_size - 1) / gopt_block_size;
+        g_reread.files[file] = (unsigned char*)calloc(g_reread.blocks, 1);
+        if (g_reread.files[file] == NULL) {
+            printf("Out of memory for block outcomes.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (block >= g_reread.blocks) return;
+    s = &g_reread.files[file][block];
+
+    if (ok) {
+        if ((*s & REREAD_FAILED) && !(*s & REREAD_RECOVERED)) {
+            *s |= REREAD_RECOVERED;
+            ++g_reread.recovered;
+        }
+        *s |= REREAD_PASSED;
+        return;
+    }
+
+    ++g_reread.pass_failed;
+    if (*s & REREAD_PASSED) {
+        ++g_reread.pass_late;
+        if (!(*s & REREAD_LATE)) {
+            *s |= REREAD_LATE;
+            ++g_reread.late;
+            printf("Block %u of random-%08u read back correctly before and "
+                   "failed in pass %u.\n", (unsigned)block, file,
+                   g_reread.pass);
+        }
+    }
+    *s |= REREAD_FAILED;
+}
+
+/******************************************************************************/
+/* Parallel verification with -j: all files are cut into chunks of a fixed
+ * size, which are dealt out to the threads as contiguous runs, so that each
+ * thread reads sequentially. A thread which runs out of chunks steals the last
+ * chunk of the thread with the most left, so no thread idles while others
+ * still have a backlog, regardless of how uneven the file sizes are. Each
+ * chunk positions its own generator with lcg_skip(). */
+
+/* size of a verify chunk, rounded down to a multiple of the block size */
+#define VERIFY_CHUNK (64 * 1024 * 1024)
+
+/* longest time in seconds a thread keeps its counts before merging them */
+#define VERIFY_MERGE_INTERVAL 0.1
+
+/* a file to verify and its per-file results */
+struct verify_file {
+    int fd;                  /* handle, -1 for an empty file */
+    uint64_t size;           /* bytes to verify */
+    unsigned int chunks_left;
+    uint64_t bytes;          /* bytes verified */
+    double start, end;       /* first chunk started and last one done */
+    uint64_t hist[STATS_HIST_BUCKETS], lat_count;
+    double lat_sum;
+};
+
+/* a chunk of a file */
+struct verify_task {
+    unsigned int file;
+    uint64_t offset, size;
+};
+
+/* state of each thread: its run of tasks [head, tail), owner takes from the
+ * head, thieves from the tail */
+struct verify_thread {
+    unsigned int id;
+    unsigned int head, tail;
+    item_type* buf;
+    item_type* expect;
+    struct phase_cost cost;
+    /* blocks of the current chunk not yet merged by verify_merge() */
+    uint64_t bytes, hist[STATS_HIST_BUCKETS], lat_count;
+    double lat_sum, lat_max, merge_time;
+#if HAVE_PTHREAD
+    pthread_t thread;
+#endif
+};
+
+struct verify_state {
+    struct verify_file* files;
+    unsigned int files_size;
+    struct verify_task* tasks;
+    struct verify_thread* threads;
+    unsigned int threads_size;
+    unsigned int steals;
+    int stop;
+#if HAVE_PTHREAD
+    pthread_mutex_t mutex;   /* protects task runs, files and g_stats */
+#endif
+};
+
+struct verify_state g_verify;
+
+void verify_lock(void)
+{
+#if HAVE_PTHREAD
+    pthread_mutex_lock(&g_verify.mutex);
+#endif
+}
+
+void verify_unlock(void)
+{
+#if HAVE_PTHREAD
+    pthread_mutex_unlock(&g_verify.mutex);
+#endif
+}
+
+/* take the next task of a thread or steal one, 0 if none is left */
+int verify_next(struct verify_thread* t, struct verify_task* task)
+{
+    struct verify_thread* victim = t;
+    unsigned int i;
+
+    verify_lock();
+    if (g_verify.stop || g_interrupted) {
+        verify_unlock();
+        return 0;
+    }
+    if (t->head == t->tail)
+    {
+        /* steal from the thread with the longest backlog */
+        victim = NULL;
+        for (i = 0; i < g_verify.threads_size; ++i) {
+            struct verify_thread* v = &g_verify.threads[i];
+            if (v->head != v->tail &&
+                (victim == NULL || v->tail - v->head >
+                 victim->tail - victim->head))
+                victim = v;
+        }
+        if (victim == NULL) {
+            verify_unlock();
+            return 0;
+        }
+        *task = g_verify.tasks[--victim->tail];
+        g_verify.steals++;
+    }
+    else {
+        *task = g_verify.tasks[t->head++];
+    }
+
+    /* begin the file with its first chunk */
+    if (g_verify.files[task->file].start == 0) {
+        stats_file_begin(task->file);
+        g_verify.files[task->file].start = timestamp();
+    }
+    verify_unlock();
+    return 1;
+}
+
+/* finish a file when its last chunk is done, called with the lock held */
+void verify_file_done(unsigned int filenum)
+{
+    struct verify_file* f = &g_verify.files[filenum];
+    char eta[64];
+    double seconds = f->end - f->start;
+    double speed = seconds > 0 ? f->bytes / 1024.0 / 1024.0 / seconds : 0;
+    struct extent_info ext;
+
+    extents_measure(NULL, f->fd, f->bytes, 0, &ext);
+    extents_record(filenum, speed, &ext);
+
+    stats_file_done();
+    report_file_add(DIR_READ, filenum, f->bytes, seconds,
+                    f->hist, f->lat_count, f->lat_sum, &ext);
+    progress_sample();
+    progress_clear();
+
+    if (progress_eta(eta)) {
+        printf("Read %.0f MiB random data from random-%08u with %f MiB/s%s, "
+               "eta %s.\n", (f->bytes / 1024.0 / 1024.0), filenum, speed,
+               extents_format(&ext), eta);
+    }
+    else {
+        printf("Read %.0f MiB random data from random-%08u with %f MiB/s%s.\n",
+               (f->bytes / 1024.0 / 1024.0), filenum, speed,
+               extents_format(&ext));
+    }
+    fflush(stdout);
+}
+
+/* add the counts of a thread to g_stats and the file of its chunk, called with
+ * the lock held. The first thread also keeps the progress line and handles
+ * signals. */
+void verify_merge(struct verify_thread* t, struct verify_file* f)
+{
+    unsigned int b;
+
+    stats_io_add(DIR_READ, t->bytes, t->hist, t->lat_count, t->lat_sum,
+                 t->lat_max);
+    f->bytes += t->bytes;
+    for (b = 0; b < STATS_HIST_BUCKETS; ++b)
+        f->hist[b] += t->hist[b];
+    f->lat_count += t->lat_count;
+    f->lat_sum += t->lat_sum;
+
+    t->bytes = t->lat_count = 0;
+    memset(t->hist, 0, sizeof(t->hist));
+    t->lat_sum = t->lat_max = 0;
+    t->merge_time = timestamp();
+
+    if (t->id == 0) {
+        if (check_signals())
+            g_verify.stop = 1;
+        progress_tick();
+    }
+}
+
+/* read and verify one chunk, counting the blocks in the thread and merging
+ * the counts under the lock only per chunk or merge interval */
+void verify_chunk(struct verify_thread* t, const struct verify_task* task)
+{
+    struct verify_file* f = &g_verify.files[task->file];
+    uint64_t pos = task->offset, end = task->offset + task->size;
+    uint64_t xn = g_seed + task->file + 1;
+    size_t size, rsize, done, items, i;
+    struct cost_mark cm;
+    ssize_t rb = 0;
+    double ts;
+
+    lcg_skip(&xn, pos / sizeof(item_type));
+    cost_mark(&cm);
+    t->merge_time = timestamp();
+
+    while (pos < end && !g_interrupted)
+    {
+        size = end - pos < gopt_block_size ? end - pos : gopt_block_size;
+        /* direct I/O needs aligned sizes */
+        rsize = gopt_direct ?
+            (size + BLOCK_ALIGN - 1) & ~(size_t)(BLOCK_ALIGN - 1) : size;
+
+        ts = timestamp();
+        for (done = 0; done < size; done += rb) {
+            rb = g_backend->pread(f->fd, (char*)t->buf + done, rsize - done,
+                                  pos + done);
+            if (rb <= 0) break;
+        }
+        ts = timestamp() - ts;
+        cost_add(&t->cost, STAGE_IO, &cm);
+
+        if (done < size)
+        {
+            verify_lock();
+            progress_clear();
+            if (rb < 0) {
+                printf("Error reading file random-%08u at offset %"PRIu64
+                       ": %s\n", task->file, pos + done, strerror(errno));
+            }
+            else {
+                printf("Unexpectedly short file random-%08u: "
+                       "read %"PRIu64" of expected %"PRIu64" bytes\n",
+                       task->file, pos + done, f->size);
+            }
+            stats_error(0);
+            exit(EXIT_FAILURE);
+        }
+
+        items = size / sizeof(item_type);
+        fill_random_block(t->expect, items, &xn);
+        cost_add(&t->cost, STAGE_GENERATE, &cm);
+        i = compare_block(t->buf, t->expect, items);
+        cost_add(&t->cost, STAGE_COMPARE, &cm);
+
+        if (i != items)
+        {
+            verify_lock();
+            PROBE2(verify__mismatch, task->file, pos + i * sizeof(item_type));
+            progress_clear();
+            printf("Mismatch to random sequence "
+                   "in file random-%08u block %u at offset %lu "
+                   "(file offset %"PRIu64")\n",
+                   task->file, (unsigned)(pos / gopt_block_size),
+                   (long unsigned)(i * sizeof(item_type)),
+                   pos + i * sizeof(item_type));
+            stats_error(1);
+            gopt_unlink_after = 0;
+            exit(EXIT_FAILURE);
+        }
+        t->bytes += size;
+        t->hist[stats_lat_bucket(ts)]++;
+        t->lat_count++;
+        t->lat_sum += ts;
+        if (ts > t->lat_max)
+            t->lat_max = ts;
+
+        pos += size;
+        if (pos < end && timestamp() - t->merge_time >= VERIFY_MERGE_INTERVAL) {
+            verify_lock();
+            verify_merge(t, f);
+            verify_unlock();
+        }
+    }
+
+    verify_lock();
+    verify_merge(t, f);
+    if (pos == end && --f->chunks_left == 0) {
+        f->end = timestamp();
+        verify_file_done(task->file);
+    }
+    verify_unlock();
+}
+
+/* thread main loop: verify tasks until none are left */
+void* verify_thread_run(void* arg)
+{
+    struct verify_thread* t = (struct verify_thread*)arg;
+    struct verify_task task;
+
+    while (verify_next(t, &task))
+        verify_chunk(t, &task);
+    return NULL;
+}
+
+/* verify the given files with gopt_verify_threads threads, each of the given
+ * sizes, and add the threads' stage costs to cost */
+void verify_parallel(const uint64_t* sizes, unsigned int files,
+                     struct phase_cost* cost)
+{
+    uint64_t chunk = VERIFY_CHUNK / gopt_block_size * gopt_block_size, off;
+    unsigned int f, i, s, tasks_size = 0, per;
+
+    if (chunk == 0) chunk = gopt_block_size;
+
+    memset(&g_verify, 0, sizeof(g_verify));
+    g_verify.files = (struct verify_file*)calloc(
+        files + 1, sizeof(struct verify_file));
+    g_verify.files_size = files;
+    for (f = 0; f < files; ++f) {
+        g_verify.files[f].fd = gopt_unlink_immediate ? g_filehandle[f] : -1;
+        g_verify.files[f].size = sizes[f];
+        g_verify.files[f].chunks_left =
+            (unsigned int)((sizes[f] + chunk - 1) / chunk);
+        tasks_size += g_verify.files[f].chunks_left;
+    }
+
+    /* cut the files into chunks in file order */
+    g_verify.tasks = (struct verify_task*)malloc(
+        (tasks_size + 1) * sizeof(struct verify_task));
+    g_verify.threads_size = gopt_verify_threads;
+    g_verify.threads = (struct verify_thread*)calloc(
+        g_verify.threads_size, sizeof(struct verify_thread));
+    if (g_verify.files == NULL || g_verify.tasks == NULL ||
+        g_verify.threads == NULL) {
+        printf("Out of memory for verify tasks.\n");
+        exit(EXIT_FAILURE);
+    }
+    for (f = 0, i = 0; f < files; ++f) {
+        for (off = 0; off < sizes[f]; off += chunk, ++i) {
+            g_verify.tasks[i].file = f;
+            g_verify.tasks[i].offset = off;
+            g_verify.tasks[i].size = sizes[f] - off < chunk ?
+                sizes[f] - off : chunk;
+        }
+    }
+
+    /* deal out contiguous runs of tasks */
+    per = (tasks_size + g_verify.threads_size - 1) / g_verify.threads_size;
+    for (s = 0; s < g_verify.threads_size; ++s) {
+        struct verify_thread* t = &g_verify.threads[s];
+        t->id = s;
+        t->head = s * per < tasks_size ? s * per : tasks_size;
+        t->tail = t->head + per < tasks_size ? t->head + per : tasks_size;
+        t->buf = (item_type*)(g_verify_bufs + 2 * s * gopt_block_size);
+        t->expect = (item_type*)(g_verify_bufs + (2 * s + 1) * gopt_block_size);
+    }
+
+    /* the backend may only be called for reads by the threads, so all files
+     * are opened before they start and closed after they are joined */
+    for (f = 0; f < files; ++f)
+    {
+        char filename[32];
+        if (g_verify.files[f].fd >= 0 || g_verify.files[f].chunks_left == 0)
+            continue;
+        sprintf(filename, "random-%08u", f);
+        g_verify.files[f].fd = g_backend->open(filename, O_RDONLY);
+        if (g_verify.files[f].fd < 0) {
+            printf("Error opening file %s: %s\n", filename, strerror(errno));
+            stats_error(0);
+            exit(EXIT_FAILURE);
+        }
+        PROBE2(file__open, f, (int)DIR_READ);
+    }
+
+    /* empty files have no chunks */
+    for (f = 0; f < files; ++f) {
+        if (g_verify.files[f].chunks_left == 0) {
+            g_verify.files[f].start = g_verify.files[f].end = timestamp();
+            verify_file_done(f);
+        }
+    }
+
+#if HAVE_PTHREAD
+    pthread_mutex_init(&g_verify.mutex, NULL);
+    for (s = 1; s < g_verify.threads_size; ++s) {
+        if (pthread_create(&g_verify.threads[s].thread, NULL,
+                           verify_thread_run, &g_verify.threads[s]) != 0) {
+            printf("Error creating verify thread: %s\n", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+    }
+#endif
+    verify_thread_run(&g_verify.threads[0]);
+#if HAVE_PTHREAD
+    for (s = 1; s < g_verify.threads_size; ++s)
+        pthread_join(g_verify.threads[s].thread, NULL);
+    pthread_mutex_destroy(&g_verify.mutex);
+#endif
+
+    for (f = 0; f < files; ++f) {
+        if (g_verify.files[f].fd >= 0 && !gopt_unlink_immediate)
+            g_backend->close(g_verify.files[f].fd);
+        PROBE3(file__close, f, g_verify.files[f].bytes, (int)DIR_READ);
+    }
+
+    /* stage times are summed over the threads */
+    for (s = 0; s < g_verify.threads_size; ++s) {
+        for (i = 0; i < STAGE_COUNT; ++i) {
+            cost->wall[i] += g_verify.threads[s].cost.wall[i];
+            cost->cycles[i] += g_verify.threads[s].cost.cycles[i];
+        }
+    }
+    if (!g_interrupted) {
+        printf("Verified %u chunks of %"PRIu64" MiB with %u threads, "
+               "%u chunks stolen.\n", tasks_size, chunk / 1024 / 1024,
+               g_verify.threads_size, g_verify.steals);
+    }
+
+    free(g_verify.files);
+    free(g_verify.tasks);
+    free(g_verify.threads);
+}
+
+/* read files and check random sequence*/
+void read_randfiles(void)
+{
+    unsigned int filenum = 0;
+    int done = 0;
+    unsigned int expected_file_limit = UINT_MAX;
+    uint64_t file_bytes = (uint64_t)gopt_file_size * 1024 * 1024;
+    uint64_t expected_bytes = 0, size;
+    struct phase_cost cost;
+
+    if (gopt_unlink_immediate) {
+        expected_file_limit = g_filehandle_size;
+
+        for (filenum = 0; filenum < g_filehandle_size; ++filenum) {
+            if (g_backend->fstat(g_filehandle[filenum], &size) == 0)
+                expected_bytes += size;
+        }
+        filenum = 0;
+    }
+    else {
+        char filename[32];
+
+        for (expected_file_limit = 0; ; ++expected_file_limit) {
+            /* check that file exists and sum up sizes */
+            sprintf(filename, "random-%08u", expected_file_limit);
+            if (g_backend->stat(filename, &size) != 0)
+                break;
+            expected_bytes += size;
+        }
+    }
+
+    printf("Verifying %u files random-######## with seed %u\n",
+           expected_file_limit, g_seed);
+    stats_phase(PHASE_VERIFY, expected_file_limit);
+    progress_start(expected_bytes);
+    cost_start(&cost);
+
+    if (gopt_verify_threads > 1)
+    {
+        uint64_t* sizes = (uint64_t*)malloc(
+            (expected_file_limit + 1) * sizeof(uint64_t));
+        uint64_t limit;
+        char filename[32];
+
+        if (sizes == NULL) {
+            printf("Out of memory for file sizes.\n");
+            exit(EXIT_FAILURE);
+        }
+        /* the same size checks as below, but before reading anything */
+        for (filenum = 0; filenum < expected_file_limit; ++filenum)
+        {
+            sprintf(filename, "random-%08u", filenum);
+            if ((gopt_unlink_immediate ?
+                 g_backend->fstat(g_filehandle[filenum], &size) :
+                 g_backend->stat(filename, &size)) != 0) {
+                printf("Error opening file %s: %s\n",
+                       filename, strerror(errno));
+                exit(EXIT_FAILURE);
+            }
+            /* the last file written may be shorter */
+            limit = file_bytes;
+            if (filenum + 1 == expected_file_limit &&
+                g_last_filesize != UINT_MAX && g_last_filesize < limit)
+                limit = g_last_filesize;
+            if (size > limit)
+                size = limit;
+            if (size < file_bytes &&
+                (filenum + 1 != expected_file_limit ||
+                 (g_last_filesize != UINT_MAX && size != g_last_filesize)))
             {
-                wb = write(fd, (char*)block + wp, sizeof(block) - wp);
+                printf("Unexpectedly short file %s: "
+                       "read %"PRIu64" of expected %"PRIu64" bytes\n",
+                       filename, size, limit);
+                stats_error(0);
+                exit(EXIT_FAILURE);
+            }
+            sizes[filenum] = size;
+        }
+        verify_parallel(sizes, expected_file_limit, &cost);
+        free(sizes);
+        done = 1;
+    }
 
-                if (wb <= 0) {
-                    printf("Error writing next file %s: %s\n",
+    while (!done)
+    {
+        char filename[32], eta[64];
+        struct extent_info ext;
+        int fd, mapped = 0;
+        unsigned int inflight = 0;
+        size_t i, items;
+        uint64_t rpos, rtotal, rend, limit;
+        double ts1, ts2, speed;
+        uint64_t rnd, xn;
+        struct cost_mark cm;
+        struct io_request* req;
+
+        sprintf(filename, "random-%08u", filenum);
+        stats_file_begin(filenum);
+        report_file_begin(DIR_READ);
+
+        if (gopt_unlink_immediate)
+        {
+            if (filenum >= g_filehandle_size) {
+                printf("Finished all opened file handles.\n");
+                break;
+            }
+
+            fd = g_filehandle[filenum];
+        }
+        else
+        {
+            fd = g_backend->open(filename, O_RDONLY);
+            if (fd < 0) {
+                progress_clear();
+                printf("Error opening next file %s: %s\n",
+                       filename, strerror(errno));
+                break;
+            }
+        }
+        PROBE2(file__open, filenum, (int)DIR_READ);
+
+        /* reset random generator for each 1 GiB file */
+        rnd = g_seed + (++filenum);
+
+        /* the last file written may be shorter, read it up to its end */
+        limit = file_bytes;
+        if (filenum == expected_file_limit && g_last_filesize != UINT_MAX &&
+            g_last_filesize < limit)
+            limit = g_last_filesize;
+
+        /* rend is the end of file, lowered when a read returns EOF */
+        rpos = rtotal = 0;
+        rend = limit;
+        ts1 = timestamp();
+
+        if (gopt_mmap)
+            mapped = verify_mmap(fd, filename, limit, rnd, &cost,
+                                 &rtotal, &rend);
+
+        while (!mapped && (inflight != 0 || (!done && rpos < rend)))
+        {
+            while (!done && rpos < rend && inflight < g_queue_depth)
+            {
+                req = request_get();
+                req->fh = fd;
+                req->dir = DIR_READ;
+                req->offset = rpos;
+                req->size = gopt_block_size;
+                if (req->size > limit - rpos)
+                    req->size = limit - rpos;
+                /* direct I/O needs aligned sizes, EOF ends the read early */
+                if (gopt_direct)
+                    req->size = (req->size + BLOCK_ALIGN - 1) &
+                        ~(size_t)(BLOCK_ALIGN - 1);
+                req->done = 0;
+
+                cost_mark(&cm);
+                request_submit(req);
+                cost_add(&cost, STAGE_IO, &cm);
+                rpos += req->size;
+                stats_inflight(++inflight);
+            }
+
+            cost_mark(&cm);
+            req = request_reap();
+            cost_add(&cost, STAGE_IO, &cm);
+            stats_inflight(--inflight);
+
+            if (req->result < 0) {
+                progress_clear();
+                printf("Error reading file %s at offset %"PRIu64": %s\n",
+                       filename, req->offset + req->done,
+                       strerror(req->error));
+                stats_error(0);
+                if (!gopt_reread)
+                    exit(EXIT_FAILURE);
+                /* the block failed, go on with the next */
+                reread_block(g_stats->filenum, req->offset, 0);
+                request_put(req);
+                continue;
+            }
+
+            if (req->result > 0) {
+                req->done += req->result;
+                stats_io_done(DIR_READ, req->result, req->latency);
+
+                /* short read, read the rest of the block */
+                if (req->done != req->size) {
+                    request_submit(req);
+                    stats_inflight(++inflight);
+                    continue;
+                }
+            }
+            else if (req->offset + req->done < rend) {
+                /* got EOF on file */
+                rend = req->offset + req->done;
+            }
+            if (req->offset + req->done > limit)
+                req->done = limit - req->offset;
+
+            /* position the generator at the block, blocks may complete out
+             * of order */
+            items = req->done / sizeof(item_type);
+            xn = rnd;
+            lcg_skip(&xn, req->offset / sizeof(item_type));
+            fill_random_block(g_expect, items, &xn);
+            cost_add(&cost, STAGE_GENERATE, &cm);
+            i = compare_block((item_type*)req->buf, g_expect, items);
+            cost_add(&cost, STAGE_COMPARE, &cm);
+
+            if (i != items)
+            {
+                PROBE2(verify__mismatch, g_stats->filenum,
+                       req->offset + i * sizeof(item_type));
+                progress_clear();
+                printf("Mismatch to random sequence "
+                       "in file %s block %u at offset %lu "
+                       "(file offset %"PRIu64")\n",
+                       filename, (unsigned)(req->offset / gopt_block_size),
+                       (long unsigned)(i * sizeof(item_type)),
+                       req->offset + i * sizeof(item_type));
+                stats_error(1);
+                gopt_unlink_after = 0;
+                if (!gopt_reread)
+                    exit(EXIT_FAILURE);
+            }
+            if (gopt_reread)
+                reread_block(g_stats->filenum, req->offset, i == items);
+
+            rtotal += req->done;
+            request_put(req);
+
+            if (check_signals())
+                done = 1;
+            progress_tick();
+        }
+
+        if (!g_interrupted && rend < file_bytes)
+        {
+            if (filenum != expected_file_limit ||
+                (g_last_filesize != UINT_MAX && rend != g_last_filesize))
+            {
+                progress_clear();
+                printf("Unexpectedly short file %s: "
+                       "read %"PRIu64" of expected %"PRIu64" bytes\n",
+                       filename, rend, limit);
+                stats_error(0);
+                exit(EXIT_FAILURE);
+            }
+            /* the last file ends the verify phase */
+            done = 1;
+        }
+
+        g_backend->close(fd);
+        PROBE3(file__close, g_stats->filenum, rtotal, (int)DIR_READ);
+
+        ts2 = timestamp();
+        stats_file_done();
+        progress_sample();
+        progress_clear();
+
+        speed = rtotal / 1024.0 / 1024.0 / (ts2 - ts1);
+        extents_measure(filename, -1, rtotal, 0, &ext);
+        extents_record(g_stats->filenum, speed, &ext);
+        report_file_end(DIR_READ, rtotal, ts2 - ts1, &ext);
+
+        if (progress_eta(eta)) {
+            printf("Read %.0f MiB random data from %s with %f MiB/s%s, "
+                   "eta %s.\n", (rtotal / 1024.0 / 1024.0), filename, speed,
+                   extents_format(&ext), eta);
+        }
+        else {
+            printf("Read %.0f MiB random data from %s with %f MiB/s%s.\n",
+                   (rtotal / 1024.0 / 1024.0), filename, speed,
+                   extents_format(&ext));
+        }
+        fflush(stdout);
+    }
+
+    if (g_interrupted)
+        exit_interrupted();
+
+    cost_report("Verify", &cost, g_stats->phase_bytes);
+    if (g_engine->report)
+        g_engine->report("Verify");
+    extents_summary("Verify");
+    phase_result_save(DIR_READ, &cost, g_stats->phase_bytes);
+    numa_account(DIR_READ, g_phase_result[DIR_READ].bytes,
+                 g_phase_result[DIR_READ].seconds);
+
+    if (gopt_reread && g_reread.pass_failed) {
+        printf("Verified %u files random-######## with seed %u, "
+               "%"PRIu64" blocks failed\n", expected_file_limit, g_seed,
+               g_reread.pass_failed);
+        return;
+    }
+    printf("Successfully verified %u files random-######## with seed %u\n",
+           expected_file_limit, g_seed);
+}
+
+/* latency average and percentiles of one direction since a stats snapshot */
+void bench_lat_delta(enum stats_dir dir, const struct filltest_stats* before,
+                     double* avg, double* p50, double* p99)
+{
+    uint64_t hist[STATS_HIST_BUCKETS], count;
+    unsigned int b;
+
+    for (b = 0; b < STATS_HIST_BUCKETS; ++b)
+        hist[b] = g_stats->lat_hist[dir][b] - before->lat_hist[dir][b];
+    count = g_stats->lat_count[dir] - before->lat_count[dir];
+
+    *avg = count ? (g_stats->lat_sum[dir] - before->lat_sum[dir]) / count : 0;
+    *p50 = stats_lat_percentile(hist, count, 50);
+    *p99 = stats_lat_percentile(hist, count, 99);
+}
+
+/* evict all random files from the page cache */
+void bench_evict_files(void)
+{
+    unsigned int filenum;
+
+    for (filenum = 0; ; ++filenum)
+    {
+        char filename[32];
+        int fd;
+
+        sprintf(filename, "random-%08u", filenum);
+        if ((fd = g_backend->open(filename, O_RDONLY)) < 0)
+            break;
+        if (g_backend->evict(fd) != 0)
+            printf("Error evicting %s from the page cache: %s\n",
+                   filename, strerror(errno));
+        g_backend->close(fd);
+    }
+}
+
+/* metrics measured in each benchmark trial */
+enum bench_metric {
+    BM_WRITE_SPEED, BM_WRITE_AVG, BM_WRITE_P50, BM_WRITE_P99,
+    BM_READ_SPEED, BM_READ_AVG, BM_READ_P50, BM_READ_P99, BM_COUNT
+};
+
+/* mean and 95% confidence half-width of each metric of the last benchmark */
+double g_bench_summary[BM_COUNT][2];
+
+/* print one row of the benchmark summary over n trials, store mean and
+ * confidence half-width in out */
+void bench_trials_line(const char* name, const double* v, unsigned int n,
+                       double out[2])
+{
+    double mean = 0, sd = 0, min = v[0], max = v[0], ci;
+    unsigned int i;
+
+    for (i = 0; i < n; ++i) {
+        mean += v[i];
+        if (v[i] < min) min = v[i];
+        if (v[i] > max) max = v[i];
+    }
+    mean /= n;
+    for (i = 0; i < n; ++i) sd += (v[i] - mean) * (v[i] - mean);
+    sd = n > 1 ? sqrt(sd / (n - 1)) : 0;
+
+    printf("%-16s %10.3f %10.3f %10.3f %10.3f", name, mean, sd, min, max);
+    if (n > 1) {
+        ci = t_critical(n - 1) * sd / sqrt((double)n);
+        printf("   [%.3f, %.3f]\n", mean - ci, mean + ci);
+    }
+    else {
+        ci = 0;
+        printf("   -\n");
+    }
+    out[0] = mean;
+    out[1] = ci;
+}
+
+/* run warm-up passes and measured trials of a bounded write and verify, and
+ * report mean, standard deviation, extremes and 95% confidence intervals */
+void bench_trials(void)
+{
+    static const char* names[BM_COUNT] = {
+        "write MiB/s", "write avg ms", "write p50 ms", "write p99 ms",
+        "verify MiB/s", "verify avg ms", "verify p50 ms", "verify p99 ms"
+    };
+    unsigned int t, m, runs = gopt_bench_warmup + gopt_bench_trials;
+    double* v[BM_COUNT];
+    struct filltest_stats before;
+
+    for (m = 0; m < BM_COUNT; ++m) {
+        v[m] = (double*)malloc(gopt_bench_trials * sizeof(double));
+        if (v[m] == NULL) {
+            printf("Out of memory for benchmark results.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    for (t = 0; t < runs; ++t)
+    {
+        int warmup = (t < gopt_bench_warmup);
+        unsigned int k = t - gopt_bench_warmup;
+
+        if (warmup)
+            printf("=== Warm-up %u/%u ===\n", t + 1, gopt_bench_warmup);
+        else
+            printf("=== Trial %u/%u ===\n", t - gopt_bench_warmup + 1,
+                   gopt_bench_trials);
+
+        stats_begin();
+        g_stats->repeat = t;
+        stats_end();
+
+        unlink_randfiles();
+
+        memcpy(&before, g_stats, sizeof(before));
+        write_randfiles();
+        if (!warmup) {
+            v[BM_WRITE_SPEED][k] =
+                g_phase_result[DIR_WRITE].bytes / 1024.0 / 1024.0 /
+                g_phase_result[DIR_WRITE].seconds;
+            bench_lat_delta(DIR_WRITE, &before,
+                            &v[BM_WRITE_AVG][k],
+                            &v[BM_WRITE_P50][k],
+                            &v[BM_WRITE_P99][k]);
+        }
+
+        /* make sure the verify pass reads from the device */
+        if (!gopt_direct)
+            bench_evict_files();
+
+        memcpy(&before, g_stats, sizeof(before));
+        read_randfiles();
+        if (!warmup) {
+            v[BM_READ_SPEED][k] =
+                g_phase_result[DIR_READ].bytes / 1024.0 / 1024.0 /
+                g_phase_result[DIR_READ].seconds;
+            bench_lat_delta(DIR_READ, &before,
+                            &v[BM_READ_AVG][k],
+                            &v[BM_READ_P50][k],
+                            &v[BM_READ_P99][k]);
+        }
+    }
+
+    unlink_randfiles();
+
+    /* latencies were measured in seconds */
+    for (t = 0; t < gopt_bench_trials; ++t) {
+        for (m = 0; m < BM_COUNT; ++m) {
+            if (m != BM_WRITE_SPEED && m != BM_READ_SPEED)
+                v[m][t] *= 1e3;
+        }
+    }
+
+    printf("\nBenchmark: %u trials after %u warm-up runs, %u files of %u MiB, "
+           "%s\n", gopt_bench_trials, gopt_bench_warmup, gopt_file_limit,
+           gopt_file_size, gopt_direct ? "direct I/O" : gopt_dontcache ?
+           "uncached buffered I/O" : "page cache evicted after writing");
+    printf("%-16s %10s %10s %10s %10s   %s\n",
+           "metric", "mean", "stddev", "min", "max", "95% CI");
+    for (m = 0; m < BM_COUNT; ++m) {
+        bench_trials_line(names[m], v[m], gopt_bench_trials,
+                          g_bench_summary[m]);
+        free(v[m]);
+    }
+}
+
+/* run the benchmark trials in each available I/O mode and compare their
+ * throughput */
+void io_mode_compare(void)
+{
+    static const char* modes[3] = { "buffered", "direct", "dontcache" };
+    double speed[3][2][2];
+    int ok[3], m;
+
+    for (m = 0; m < 3; ++m)
+    {
+        ok[m] = 0;
+        if (m == 1 && (O_DIRECT == 0 || g_backend != &g_backend_posix)) {
+            printf("\nDirect I/O is not available, skipped.\n");
+            continue;
+        }
+        if (m == 2 && !dontcache_supported()) {
+            printf("\nUncached buffered I/O (RWF_DONTCACHE) is not "
+                   "supported here, skipped.\n");
+            continue;
+        }
+        gopt_direct = (m == 1);
+        gopt_dontcache = (m == 2);
+        gopt_evict = !gopt_direct;
+
+        printf("\n=== I/O mode %s ===\n", modes[m]);
+        bench_trials();
+        memcpy(speed[m][DIR_WRITE], g_bench_summary[BM_WRITE_SPEED],
+               sizeof(speed[m][DIR_WRITE]));
+        memcpy(speed[m][DIR_READ], g_bench_summary[BM_READ_SPEED],
+               sizeof(speed[m][DIR_READ]));
+        ok[m] = 1;
+    }
+
+    printf("\nI/O mode comparison, mean MiB/s with 95%% confidence "
+           "half-width:\n%-10s %24s %24s\n", "mode", "write", "verify");
+    for (m = 0; m < 3; ++m) {
+        if (!ok[m]) continue;
+        printf("%-10s %14.3f +- %7.3f %14.3f +- %7.3f\n", modes[m],
+               speed[m][DIR_WRITE][0], speed[m][DIR_WRITE][1],
+               speed[m][DIR_READ][0], speed[m][DIR_READ][1]);
+    }
+}
+
+/* smallest and largest aging file, sizes are spread evenly on a log scale
+ * between them */
+#define AGE_SIZE_MIN (64 * 1024)
+#define AGE_SIZE_MAX (64 * 1024 * 1024)
+
+/* number of aging files written at once, interleaving their extents */
+#define AGE_STREAMS 8
+
+/* separates the aging generators from those of the random files */
+#define AGE_SALT 0x5A6E5A6EU
+
+/* an aging file being written */
+struct age_stream {
+    int fd;
+    uint64_t size, pos;
+    uint64_t rnd;            /* data generator */
+};
+
+/* draw the size of the next aging file, a multiple of 4 KiB */
+uint64_t age_size(uint64_t* rnd)
+{
+    double u = (double)(lcg_random(rnd) >> 11) / 9007199254740992.0;
+    uint64_t size = (uint64_t)(AGE_SIZE_MIN *
+                               pow((double)AGE_SIZE_MAX / AGE_SIZE_MIN, u));
+    return (size + 4095) & ~(uint64_t)4095;
+}
+
+/* write aging files of mixed sizes in turns of one request each until target
+ * bytes are written or the volume is full, returns the number of files */
+unsigned int age_fill(uint64_t target, uint64_t* written)
+{
+    struct age_stream s[AGE_STREAMS];
+    struct io_request* req = request_get();
+    uint64_t rnd = g_seed ^ AGE_SALT, next = target / 10;
+    unsigned int files = 0, i;
+    int done = 0;
+
+    for (i = 0; i < AGE_STREAMS; ++i)
+        s[i].fd = -1;
+    *written = 0;
+
+    while (!done)
+    {
+        for (i = 0; i < AGE_STREAMS && !done; ++i)
+        {
+            struct age_stream* st = &s[i];
+            char filename[32];
+            size_t n;
+            ssize_t w;
+
+            if (st->fd < 0)
+            {
+                sprintf(filename, "age-%08u", files);
+                st->fd = g_backend->open(filename,
+                                         O_WRONLY | O_CREAT | O_TRUNC);
+                if (st->fd < 0) {
+                    printf("Error opening aging file %s: %s\n",
                            filename, strerror(errno));
                     done = 1;
                     break;
                 }
-                else {
-                    wp += wb;
+                st->size = age_size(&rnd);
+                st->pos = 0;
+                st->rnd = (g_seed ^ AGE_SALT) + (++files);
+            }
+
+            n = gopt_block_size;
+            if (n > st->size - st->pos)
+                n = st->size - st->pos;
+            if (n > target - *written)
+                n = (target - *written) & ~(uint64_t)4095;
+            if (n == 0) {
+                done = 1;
+                break;
+            }
+
+            fill_random_block_lcg((item_type*)req->buf,
+                                  n / sizeof(item_type), &st->rnd);
+            w = g_backend->pwrite(st->fd, req->buf, n, st->pos);
+            if (w > 0)
+                *written += w;
+            if (w != (ssize_t)n) {
+                /* a full volume ends the aging */
+                if (w < 0 && errno != ENOSPC) {
+                    printf("Error writing aging file age-%08u: %s\n",
+                           files - 1, strerror(errno));
                 }
+                done = 1;
+                break;
             }
 
-            wtotal += wp;
-        }
+            /* allocate the extents in the order of the turns */
+            if (g_backend->writeback)
+                g_backend->writeback(st->fd, st->pos, n, 0);
 
-        if (gopt_unlink_immediate) { /* do not close file handle! */
-            filehandle_append(fd);
+            st->pos += n;
+            if (st->pos == st->size) {
+                g_backend->close(st->fd);
+                st->fd = -1;
+            }
         }
-        else {
-            close(fd);
+
+        if (*written >= next && !done) {
+            printf("Aging: wrote %.0f MiB in %u files, %.0f%%.\n",
+                   *written / 1024.0 / 1024.0, files,
+                   100.0 * *written / target);
+            fflush(stdout);
+            next += target / 10;
         }
 
-        ts2 = timestamp();
+        if (check_signals())
+            done = 1;
+    }
 
-        speed = wtotal / 1024.0 / 1024.0 / (ts2 - ts1);
-        g_last_filesize = wtotal;
+    for (i = 0; i < AGE_STREAMS; ++i) {
+        if (s[i].fd >= 0)
+            g_backend->close(s[i].fd);
+    }
+    request_put(req);
 
-        if (expected_file_limit != UINT_MAX && filenum <= expected_file_limit) {
-            format_time(
-                (expected_file_limit - filenum) * gopt_file_size / speed, eta);
+    if (g_interrupted)
+        exit_interrupted();
 
-            printf("Wrote %.0f MiB random data to %s with %f MiB/s, eta %s.\n",
-                   (wtotal / 1024.0 / 1024.0), filename, speed, eta);
-        }
-        else {
-            printf("Wrote %.0f MiB random data to %s with %f MiB/s.\n",
-                   (wtotal / 1024.0 / 1024.0), filename, speed);
+    return files;
+}
+
+/* delete gopt_age percent of the aging files in a pseudo-random pattern,
+ * returns the number of files deleted */
+unsigned int age_delete(unsigned int files, uint64_t* freed)
+{
+    uint64_t rnd = ~(uint64_t)(g_seed ^ AGE_SALT);
+    unsigned int file, count = 0;
+
+    *freed = 0;
+    for (file = 0; file < files; ++file)
+    {
+        char filename[32];
+        uint64_t size;
+
+        if ((lcg_random(&rnd) >> 33) % 100 >= gopt_age)
+            continue;
+
+        sprintf(filename, "age-%08u", file);
+        if (g_backend->stat(filename, &size) != 0)
+            size = 0;
+        if (g_backend->unlink(filename) != 0) {
+            printf("Error deleting aging file %s: %s\n",
+                   filename, strerror(errno));
+            continue;
         }
-        fflush(stdout);
+        *freed += size;
+        ++count;
     }
+    return count;
+}
 
-    errno = 0;
+/* one write and verify pass of the aging comparison */
+void age_pass(unsigned int repeat, struct phase_result res[2])
+{
+    stats_begin();
+    g_stats->repeat = repeat;
+    stats_end();
+
+    memset(g_phase_result, 0, sizeof(g_phase_result));
+    unlink_randfiles();
+    write_randfiles();
+    if (!gopt_skip_verify)
+        read_randfiles();
+    memcpy(res, g_phase_result, sizeof(g_phase_result));
 }
 
-/* read files and check random sequence*/
-void read_randfiles(void)
+/* print one line of the aging comparison */
+void age_line(const char* phase, const struct phase_result* fresh,
+              const struct phase_result* aged)
 {
-    unsigned int filenum = 0;
-    int done = 0;
-    unsigned int expected_file_limit = UINT_MAX;
+    double f = fresh->seconds > 0 ?
+        fresh->bytes / 1024.0 / 1024.0 / fresh->seconds : 0;
+    double a = aged->seconds > 0 ?
+        aged->bytes / 1024.0 / 1024.0 / aged->seconds : 0;
 
-    if (gopt_unlink_immediate) {
-        expected_file_limit = g_filehandle_size;
+    if (f <= 0) return;
+    printf("%-8s %12.3f %12.3f %+8.1f%%\n", phase, f, a, 100.0 * (a / f - 1));
+}
+
+/* measure fill and verify on the fresh volume, age the volume by filling it
+ * with interleaved files of mixed sizes and deleting a fraction of them, then
+ * measure fill and verify into the holes and compare */
+void age_run(void)
+{
+    uint64_t file_bytes = (uint64_t)gopt_file_size * 1024 * 1024;
+    uint64_t avail, target, written, freed;
+    struct phase_result fresh[2], aged[2];
+    unsigned int files, deleted;
+    double ts;
+
+    unlink_randfiles();
+    if ((files = age_unlink()) != 0)
+        printf("Removed %u old aging files.\n", files);
+
+    if (g_backend->statfs(&avail) != 0) {
+        printf("Aging needs the free space of the volume: %s\n",
+               strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    target = gopt_age_bytes && gopt_age_bytes < avail ? gopt_age_bytes : avail;
+    target &= ~(uint64_t)4095;
+
+    /* both passes write what is expected to fit into the holes */
+    if (gopt_file_limit == UINT_MAX) {
+        gopt_file_limit = (unsigned int)(target / 100 * gopt_age / file_bytes);
+        if (gopt_file_limit == 0)
+            gopt_file_limit = 1;
+    }
+
+    printf("=== Fresh volume ===\n");
+    age_pass(0, fresh);
+    unlink_randfiles();
+
+    printf("=== Aging %.0f MiB with seed %u ===\n",
+           target / 1024.0 / 1024.0, g_seed);
+    ts = timestamp();
+    g_aging = 1;
+    files = age_fill(target, &written);
+    deleted = age_delete(files, &freed);
+    printf("Aged volume in %.1f s: wrote %.0f MiB in %u files, "
+           "deleted %u files of %.0f MiB.\n", timestamp() - ts,
+           written / 1024.0 / 1024.0, files, deleted, freed / 1024.0 / 1024.0);
+
+    printf("=== Aged volume ===\n");
+    age_pass(1, aged);
+    if (gopt_unlink_after)
+        unlink_randfiles();
+    printf("Removed %u aging files.\n", age_unlink());
+    g_aging = 0;
+
+    printf("\nAging: %u files of %u MiB on the fresh volume and into the "
+           "holes of %u%% deleted files of %u KiB to %u MiB\n",
+           gopt_file_limit, gopt_file_size, gopt_age,
+           AGE_SIZE_MIN / 1024, AGE_SIZE_MAX / 1024 / 1024);
+    printf("%-8s %12s %12s %9s\n", "phase", "fresh MiB/s", "aged MiB/s",
+           "change");
+    age_line("write", &fresh[DIR_WRITE], &aged[DIR_WRITE]);
+    age_line("verify", &fresh[DIR_READ], &aged[DIR_READ]);
+}
+
+/* results of one pass of --reread */
+struct reread_pass {
+    double speed;            /* MiB/s */
+    uint64_t failed, late;   /* blocks failed, of which passed before */
+    uint32_t errors;         /* read errors */
+};
+
+/* write the files once, or take them as they are with -r, and verify them
+ * gopt_reread times from the device, then report how the blocks changed */
+void reread_run(void)
+{
+    struct reread_pass* passes;
+    unsigned int p;
+
+    passes = (struct reread_pass*)calloc(gopt_reread,
+                                         sizeof(struct reread_pass));
+    if (passes == NULL) {
+        printf("Out of memory for read passes.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (!gopt_readonly) {
+        unlink_randfiles();
+        write_randfiles();
+    }
+
+    for (p = 0; p < gopt_reread; ++p)
+    {
+        const struct phase_result* r = &g_phase_result[DIR_READ];
+        uint32_t errors = g_stats->errors;
+
+        printf("=== Read pass %u/%u ===\n", p + 1, gopt_reread);
+        stats_begin();
+        g_stats->repeat = p;
+        stats_end();
+
+        /* each pass reads from the device */
+        if (!gopt_direct)
+            bench_evict_files();
+
+        g_reread.pass = p + 1;
+        g_reread.pass_failed = g_reread.pass_late = 0;
+        memset(g_phase_result, 0, sizeof(g_phase_result));
+        read_randfiles();
+
+        passes[p].speed = r->seconds > 0 ?
+            r->bytes / 1024.0 / 1024.0 / r->seconds : 0;
+        passes[p].failed = g_reread.pass_failed;
+        passes[p].late = g_reread.pass_late;
+        passes[p].errors = g_stats->errors - errors;
+    }
+
+    if (gopt_unlink_after)
+        unlink_randfiles();
+
+    printf("\nRepeated reads: %u passes, %s\n", gopt_reread,
+           gopt_direct ? "direct I/O" : "page cache evicted before each pass");
+    printf("%-6s %12s %14s %14s %12s\n", "pass", "MiB/s", "failed blocks",
+           "passed before", "read errors");
+    for (p = 0; p < gopt_reread; ++p) {
+        printf("%-6u %12.3f %14"PRIu64" %14"PRIu64" %12u\n", p + 1,
+               passes[p].speed, passes[p].failed, passes[p].late,
+               passes[p].errors);
+    }
+    if (g_reread.late || g_reread.recovered) {
+        printf("Unstable blocks: %"PRIu64" read back correctly and failed in "
+               "a later pass, %"PRIu64" failed and read back correctly "
+               "later.\n", g_reread.late, g_reread.recovered);
     }
     else {
-        char filename[32];
-        int fd;
+        printf("No block changed between passes.\n");
+    }
+    free(passes);
+}
 
-        for (expected_file_limit = 0; ; ++expected_file_limit) {
-            /* attempt to open file */
-            sprintf(filename, "random-%08u", expected_file_limit);
-            fd = open(filename, O_RDONLY | O_BINARY);
-            if (fd < 0)
-                break;
-            close(fd);
+/* seconds between checkpoint updates and between metric lines */
+#define SCRUB_CHECKPOINT_INTERVAL 60
+#define SCRUB_METRICS_INTERVAL 3600
+
+/* position and totals of the scrubber, kept in the checkpoint file */
+struct scrub_state {
+    unsigned int seed, pass, file;
+    uint64_t offset;         /* next offset in file */
+    uint64_t bytes;          /* bytes scrubbed in all passes */
+    uint64_t errors, mismatches;
+};
+
+/* load the checkpoint, returns 0 if there is none */
+int scrub_load(struct scrub_state* st)
+{
+    FILE* f = fopen(gopt_scrub_checkpoint, "r");
+    char line[512];
+    double v;
+
+    if (f == NULL) return 0;
+    if (fgets(line, sizeof(line), f) == NULL ||
+        !json_number(line, "seed", &v)) {
+        printf("Invalid scrub checkpoint %s.\n", gopt_scrub_checkpoint);
+        exit(EXIT_FAILURE);
+    }
+    fclose(f);
+
+    st->seed = (unsigned int)v;
+    if (json_number(line, "pass", &v)) st->pass = (unsigned int)v;
+    if (json_number(line, "file", &v)) st->file = (unsigned int)v;
+    if (json_number(line, "offset", &v)) st->offset = (uint64_t)v;
+    if (json_number(line, "bytes", &v)) st->bytes = (uint64_t)v;
+    if (json_number(line, "errors", &v)) st->errors = (uint64_t)v;
+    if (json_number(line, "mismatches", &v)) st->mismatches = (uint64_t)v;
+    return 1;
+}
+
+/* replace the checkpoint atomically by renaming a complete new file over it */
+void scrub_save(const struct scrub_state* st)
+{
+    char tmp[1024];
+    FILE* f;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", gopt_scrub_checkpoint);
+    if ((f = fopen(tmp, "w")) == NULL) {
+        printf("Error writing scrub checkpoint %s: %s\n",
+               tmp, strerror(errno));
+        return;
+    }
+    fprintf(f, "{ \"seed\": %u, \"pass\": %u, \"file\": %u, "
+            "\"offset\": %"PRIu64", \"bytes\": %"PRIu64", "
+            "\"errors\": %"PRIu64", \"mismatches\": %"PRIu64" }\n",
+            st->seed, st->pass, st->file, st->offset, st->bytes,
+            st->errors, st->mismatches);
+    fflush(f);
+#if HAVE_FSYNC
+    fsync(fileno(f));
+#endif
+    if (fclose(f) != 0 || rename(tmp, gopt_scrub_checkpoint) != 0) {
+        printf("Error writing scrub checkpoint %s: %s\n",
+               gopt_scrub_checkpoint, strerror(errno));
+    }
+}
+
+/* report a failed block on stdout, to syslog and to the alert command */
+void scrub_alert(const char* kind, unsigned int file, uint64_t offset,
+                 const char* detail)
+{
+    char msg[256];
+
+    snprintf(msg, sizeof(msg), "%s in file random-%08u at offset %"PRIu64
+             " (seed %u): %s", kind, file, offset, g_seed, detail);
+    printf("ALERT: %s\n", msg);
+    fflush(stdout);
+#if HAVE_SYSLOG
+    syslog(LOG_ERR, "%s", msg);
+#endif
+
+    if (gopt_scrub_alert) {
+        char cmd[1024], name[32], pos[32];
+        int status = -1;
+#if HAVE_FORK
+        pid_t pid;
+#endif
+        snprintf(name, sizeof(name), "random-%08u", file);
+        snprintf(pos, sizeof(pos), "%"PRIu64, offset);
+#if HAVE_FORK
+        /* the shell runs the command with the arguments as "$@", so they
+         * are passed as they are and never parsed by it */
+        snprintf(cmd, sizeof(cmd), "%s \"$@\"", gopt_scrub_alert);
+        fflush(stdout);
+        pid = fork();
+        if (pid == 0) {
+            execl("/bin/sh", "sh", "-c", cmd, "sh", kind, name, pos,
+                  (char*)NULL);
+            _exit(127);
         }
+        if (pid > 0) {
+            while (waitpid(pid, &status, 0) < 0 && errno == EINTR) { }
+        }
+        if (status != 0)
+            printf("Alert command failed: %s %s %s %s\n",
+                   gopt_scrub_alert, kind, name, pos);
+#else
+        /* the arguments are plain words, nothing in them needs quoting */
+        snprintf(cmd, sizeof(cmd), "%s %s %s %s",
+                 gopt_scrub_alert, kind, name, pos);
+        status = system(cmd);
+        if (status != 0)
+            printf("Alert command failed: %s\n", cmd);
+#endif
     }
+}
 
-    printf("Verifying %u files random-######## with seed %u\n",
-           expected_file_limit, g_seed);
+/* print the totals of the scrubber and send them to syslog */
+void scrub_metrics(const struct scrub_state* st, double speed)
+{
+    char msg[256], pos[64];
 
-    while (!done)
-    {
-        char filename[32], eta[64];
-        int fd;
-        ssize_t rb;
-        unsigned int i, blocknum;
-        uint64_t rtotal;
-        double ts1, ts2, speed;
-        uint64_t rnd;
+    if (st->offset == 0 && st->file == 0)
+        snprintf(pos, sizeof(pos), "done");
+    else
+        snprintf(pos, sizeof(pos), "at random-%08u offset %"PRIu64,
+                 st->file, st->offset);
+    snprintf(msg, sizeof(msg), "scrub pass %u %s: %.1f MiB/s, %.0f MiB "
+             "scrubbed in total, %"PRIu64" read errors, %"PRIu64" mismatches",
+             st->pass, pos, speed, st->bytes / 1024.0 / 1024.0,
+             st->errors, st->mismatches);
+    printf("%s\n", msg);
+    fflush(stdout);
+#if HAVE_SYSLOG
+    syslog(LOG_INFO, "%s", msg);
+#endif
+}
 
-        item_type block[(1024 * 1024) / sizeof(item_type)];
+/* sleep until the next block is due under the rate budget */
+void scrub_throttle(double* due, size_t bytes)
+{
+    double now = timestamp(), delay;
+    struct timespec ts;
 
-        sprintf(filename, "random-%08u", filenum);
+    /* do not catch up with more than a second of a stall */
+    if (*due < now - 1.0)
+        *due = now - 1.0;
+    *due += bytes / (gopt_scrub * 1024 * 1024);
 
-        if (gopt_unlink_immediate)
-        {
-            if (filenum >= g_filehandle_size) {
-                printf("Finished all opened file handles.\n");
-                break;
-            }
+    if ((delay = *due - now) <= 0) return;
+    ts.tv_sec = (time_t)delay;
+    ts.tv_nsec = (long)((delay - (double)ts.tv_sec) * 1e9);
+    /* a signal ends the sleep early */
+    nanosleep(&ts, NULL);
+}
 
-            fd = g_filehandle[filenum];
+/* verify the retained random files over and over within the rate budget,
+ * continuing from the checkpoint, until interrupted */
+void scrub_run(void)
+{
+    struct scrub_state st;
+    struct io_request* req = request_get();
+    double due = timestamp(), last_save = due, last_metrics = due;
+    double start = due;
+    uint64_t session = 0;
 
-            if (lseek(fd, 0, SEEK_SET) != 0) {
-                printf("Error seeking in next file %s: %s\n",
-                       filename, strerror(errno));
-                exit(EXIT_FAILURE);
-            }
+    memset(&st, 0, sizeof(st));
+    if (scrub_load(&st)) {
+        if (g_seed_given && st.seed != g_seed) {
+            printf("Seed %u differs from seed %u of the files in scrub "
+                   "checkpoint %s.\n", g_seed, st.seed, gopt_scrub_checkpoint);
+            exit(EXIT_FAILURE);
         }
-        else
-        {
-            fd = open(filename, O_RDONLY | O_BINARY);
-            if (fd < 0) {
-                printf("Error opening next file %s: %s\n",
-                       filename, strerror(errno));
+        g_seed = st.seed;
+        printf("Resuming scrub pass %u at random-%08u offset %"PRIu64
+               " from %s.\n", st.pass, st.file, st.offset,
+               gopt_scrub_checkpoint);
+    }
+    else if (!g_seed_given) {
+        printf("Scrubbing needs the seed the files were written with, "
+               "give it with -s.\n");
+        exit(EXIT_FAILURE);
+    }
+    else {
+        st.seed = g_seed;
+        st.pass = 1;
+    }
+
+#if HAVE_SYSLOG
+    openlog("disk-filltest", LOG_PID, LOG_DAEMON);
+#endif
+    printf("Scrubbing files random-######## with seed %u at %.1f MiB/s, "
+           "checkpoint %s\n", g_seed, gopt_scrub, gopt_scrub_checkpoint);
+    fflush(stdout);
+
+    while (!g_interrupted)
+    {
+        unsigned int files;
+        char filename[32];
+        uint64_t size;
+
+        /* count the retained files at the start of each pass */
+        for (files = 0; ; ++files) {
+            sprintf(filename, "random-%08u", files);
+            if (g_backend->stat(filename, &size) != 0)
                 break;
-            }
         }
+        if (files == 0) {
+            printf("No files random-######## to scrub.\n");
+            exit(EXIT_FAILURE);
+        }
+        if (st.file >= files)
+            st.file = 0, st.offset = 0;
 
-        /* reset random generator for each 1 GiB file */
-        rnd = g_seed + (++filenum);
-
-        rtotal = 0;
-        ts1 = timestamp();
+        stats_begin();
+        g_stats->repeat = st.pass;
+        stats_end();
+        stats_phase(PHASE_VERIFY, files);
 
-        for (blocknum = 0; blocknum < gopt_file_size; ++blocknum)
+        for (; st.file < files && !g_interrupted; ++st.file, st.offset = 0)
         {
-            unsigned int read_size = sizeof(block);
-            if (filenum == expected_file_limit && g_last_filesize != UINT_MAX &&
-                blocknum * sizeof(block) > g_last_filesize) {
-                read_size = g_last_filesize - (blocknum - 1) * sizeof(block);
+            int fd;
+
+            sprintf(filename, "random-%08u", st.file);
+            fd = g_backend->open(filename, O_RDONLY);
+            if (fd < 0 || g_backend->fstat(fd, &size) != 0) {
+                scrub_alert("open-error", st.file, 0, strerror(errno));
+                ++st.errors;
+                stats_error(0);
+                if (fd >= 0) g_backend->close(fd);
+                continue;
             }
-            rb = read(fd, block, read_size);
+            stats_file_begin(st.file);
 
-            if (rb == 0) {
-                /* got EOF on file */
-                if (filenum != expected_file_limit ||
-                    (g_last_filesize != UINT_MAX && rtotal != g_last_filesize))
-                {
-                    printf("Unexpectedly short file %s: "
-                           "read %u of expected %"PRIu64" bytes\n",
-                           filename, g_last_filesize, rtotal);
-                    done = 1;
-                    exit(EXIT_FAILURE);
+            /* read what was retained, not what may be cached */
+            if (!gopt_direct)
+                g_backend->evict(fd);
+
+            while (st.offset < size && !g_interrupted)
+            {
+                size_t n = gopt_block_size, items, i;
+                uint64_t xn;
+                ssize_t r;
+                double ts = timestamp();
+
+                if (n > size - st.offset)
+                    n = size - st.offset;
+                if (gopt_direct)
+                    n = (n + BLOCK_ALIGN - 1) & ~(size_t)(BLOCK_ALIGN - 1);
+
+                r = g_backend->pread(fd, req->buf, n, st.offset);
+                if (r < 0) {
+                    scrub_alert("read-error", st.file, st.offset,
+                                strerror(errno));
+                    ++st.errors;
+                    stats_error(0);
+                    /* skip the block, but not past the end of the file */
+                    r = (ssize_t)(n < size - st.offset ? n : size - st.offset);
+                }
+                else if (r == 0) {
+                    break;
                 }
+                else {
+                    stats_io_done(DIR_READ, r, timestamp() - ts);
 
-                done = 1;
-                break;
-            }
-            else if (rb < 0) {
-                printf("Error reading file %s: %s\n",
-                       filename, strerror(errno));
-                done = 1;
-                exit(EXIT_FAILURE);
-            }
+                    items = r / sizeof(item_type);
+                    xn = g_seed + st.file + 1;
+                    lcg_skip(&xn, st.offset / sizeof(item_type));
+                    fill_random_block(g_expect, items, &xn);
+                    i = compare_block((item_type*)req->buf, g_expect, items);
+                    if (i != items) {
+                        char detail[64];
+                        snprintf(detail, sizeof(detail),
+                                 "first differing byte at %"PRIu64,
+                                 st.offset + i * sizeof(item_type));
+                        scrub_alert("mismatch", st.file, st.offset, detail);
+                        ++st.mismatches;
+                        stats_error(1);
+                    }
+                }
 
-            for (i = 0; i < rb  / sizeof(item_type); ++i)
-            {
-                if (block[i] != lcg_random(&rnd))
-                {
-                    printf("Mismatch to random sequence "
-                           "in file %s block %d at offset %lu\n",
-                           filename, blocknum,
-                           (long unsigned)(i * sizeof(int)));
-                    gopt_unlink_after = 0;
-                    exit(EXIT_FAILURE);
+                st.offset += r;
+                st.bytes += r;
+                session += r;
+
+                if (timestamp() - last_save >= SCRUB_CHECKPOINT_INTERVAL) {
+                    scrub_save(&st);
+                    last_save = timestamp();
                 }
+                if (timestamp() - last_metrics >= SCRUB_METRICS_INTERVAL) {
+                    scrub_metrics(&st, session / 1024.0 / 1024.0 /
+                                  (timestamp() - start));
+                    last_metrics = timestamp();
+                }
+
+                scrub_throttle(&due, r);
+                check_signals();
             }
 
-            rtotal += rb;
+            g_backend->close(fd);
+            stats_file_done();
+            if (g_interrupted) break;
+        }
+
+        if (!g_interrupted) {
+            st.file = 0;
+            st.offset = 0;
+            scrub_metrics(&st, session / 1024.0 / 1024.0 /
+                          (timestamp() - start));
+            ++st.pass;
         }
+        scrub_save(&st);
+        last_save = timestamp();
+    }
 
-        close(fd);
+    printf("Scrub stopped, position saved in %s.\n", gopt_scrub_checkpoint);
+    scrub_metrics(&st, session / 1024.0 / 1024.0 / (timestamp() - start));
+#if HAVE_SYSLOG
+    closelog();
+#endif
+    request_put(req);
+}
 
-        ts2 = timestamp();
+/* results of one bounded write and verify run */
+struct sweep_result {
+    double speed[2];         /* throughput in MiB/s by enum stats_dir */
+    double p99[2];           /* p99 request latency in seconds */
+};
 
-        speed = rtotal / 1024.0 / 1024.0 / (ts2 - ts1);
-        format_time(
-            (expected_file_limit - filenum) * gopt_file_size / speed, eta);
+/* run one bounded write and verify with given request size and queue depth */
+void sweep_run(size_t block_size, unsigned int depth, struct sweep_result* res)
+{
+    struct filltest_stats before;
+    double avg, p50;
+    int dir;
 
-        printf("Read %.0f MiB random data from %s with %f MiB/s, eta %s.\n",
-               (rtotal / 1024.0 / 1024.0), filename, speed, eta);
-        fflush(stdout);
+    engine_stop();
+    gopt_block_size = block_size;
+    gopt_queue_depth = depth;
+    engine_start();
+
+    unlink_randfiles();
+    memset(g_phase_result, 0, sizeof(g_phase_result));
+
+    memcpy(&before, g_stats, sizeof(before));
+    write_randfiles();
+    bench_lat_delta(DIR_WRITE, &before, &avg, &p50, &res->p99[DIR_WRITE]);
+
+    if (!gopt_direct)
+        bench_evict_files();
+
+    memcpy(&before, g_stats, sizeof(before));
+    read_randfiles();
+    bench_lat_delta(DIR_READ, &before, &avg, &p50, &res->p99[DIR_READ]);
+
+    unlink_randfiles();
+
+    for (dir = DIR_WRITE; dir <= DIR_READ; ++dir) {
+        const struct phase_result* r = &g_phase_result[dir];
+        res->speed[dir] = r->seconds > 0 ?
+            r->bytes / 1024.0 / 1024.0 / r->seconds : 0;
     }
+}
 
-    printf("Successfully verified %u files random-######## with seed %u\n",
-           expected_file_limit, g_seed);
+/* print one matrix of sweep results, rows are request sizes and columns
+ * queue depths. The knee is the smallest depth reaching 90% of the best
+ * throughput of the row. */
+void sweep_matrix(const char* title, const struct sweep_result* res,
+                  enum stats_dir dir, int latency)
+{
+    unsigned int s, d;
+    char size[16], label[16];
+
+    printf("\n%s\n%-8s", title, "size");
+    for (d = 0; d < g_sweep_depths_size; ++d) {
+        snprintf(label, sizeof(label), "qd %u", g_sweep_depths[d]);
+        printf(" %10s", label);
+    }
+    printf("%s\n", latency ? "" : "  knee");
+
+    for (s = 0; s < g_sweep_sizes_size; ++s)
+    {
+        const struct sweep_result* row = res + s * g_sweep_depths_size;
+        double best = 0;
+
+        format_size(g_sweep_sizes[s], size);
+        printf("%-8s", size);
+        for (d = 0; d < g_sweep_depths_size; ++d) {
+            printf(" %10.3f",
+                   latency ? row[d].p99[dir] * 1e3 : row[d].speed[dir]);
+            if (row[d].speed[dir] > best) best = row[d].speed[dir];
+        }
+        if (!latency) {
+            for (d = 0; d < g_sweep_depths_size; ++d) {
+                if (row[d].speed[dir] >= 0.9 * best) break;
+            }
+            printf("  qd %u", d < g_sweep_depths_size ? g_sweep_depths[d] : 0);
+        }
+        printf("\n");
+    }
+}
+
+/* measure throughput and latency over a grid of request sizes and queue
+ * depths with short bounded write and verify runs */
+void sweep(void)
+{
+    struct sweep_result* res;
+    unsigned int s, d;
+
+    res = (struct sweep_result*)calloc(
+        g_sweep_sizes_size * g_sweep_depths_size, sizeof(struct sweep_result));
+    if (res == NULL) {
+        printf("Out of memory for sweep results.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (s = 0; s < g_sweep_sizes_size; ++s)
+    {
+        for (d = 0; d < g_sweep_depths_size; ++d)
+        {
+            struct sweep_result* r = &res[s * g_sweep_depths_size + d];
+            char size[16];
+
+            format_size(g_sweep_sizes[s], size);
+            printf("=== Request size %s, queue depth %u ===\n",
+                   size, g_sweep_depths[d]);
+            sweep_run(g_sweep_sizes[s], g_sweep_depths[d], r);
+            printf("=== %s qd %u: write %.1f MiB/s, verify %.1f MiB/s ===\n",
+                   size, g_sweep_depths[d],
+                   r->speed[DIR_WRITE], r->speed[DIR_READ]);
+        }
+    }
+
+    printf("\nSweep: %u files of %u MiB per run, %s\n",
+           gopt_file_limit, gopt_file_size,
+           gopt_direct ? "direct I/O" : "page cache evicted after writing");
+    sweep_matrix("Write throughput in MiB/s:", res, DIR_WRITE, 0);
+    sweep_matrix("Write p99 latency in ms:", res, DIR_WRITE, 1);
+    sweep_matrix("Verify throughput in MiB/s:", res, DIR_READ, 0);
+    sweep_matrix("Verify p99 latency in ms:", res, DIR_READ, 1);
+    free(res);
+}
+
+/* print one line of the end-to-end benchmark table */
+void bench_e2e_line(const char* backend, enum stats_dir dir)
+{
+    const struct phase_result* r = &g_phase_result[dir];
+    double mib = r->bytes / 1024.0 / 1024.0;
+    double tool = r->seconds - r->cost.wall[STAGE_IO];
+
+    if (r->seconds <= 0) return;
+    if (tool <= 0) tool = 1e-9;
+
+    printf("%-8s %-7s %10.1f %10.1f %8.1f%% %9.2f %9.2f %9.2f\n",
+           backend, dir == DIR_WRITE ? "write" : "verify",
+           mib / r->seconds, mib / tool, 100.0 * tool / r->seconds,
+           r->cost.wall[STAGE_GENERATE], r->cost.wall[STAGE_IO],
+           r->cost.wall[STAGE_COMPARE]);
+}
+
+/* run the full fill and verify flow against the null, mem and tmpfs backends
+ * and report how much of the end-to-end throughput the tool itself limits */
+void bench_e2e(void)
+{
+    static const char* backends[] = { "null", "mem", "tmpfs", NULL };
+    struct phase_result results[3][2];
+    char spec[64];
+    int b;
+
+    /* the mem backend must hold all files */
+    snprintf(spec, sizeof(spec), "%u",
+             (gopt_file_limit * gopt_file_size) + 64);
+
+    for (b = 0; backends[b]; ++b)
+    {
+        char bspec[80];
+        snprintf(bspec, sizeof(bspec), "%s:%s", backends[b],
+                 b == 2 ? "/dev/shm" : spec);
+
+        printf("=== Backend %s ===\n", backends[b]);
+        memset(g_phase_result, 0, sizeof(g_phase_result));
+        backend_select(bspec);
+
+        write_randfiles();
+        /* null backend discards data, nothing to verify */
+        if (b != 0)
+            read_randfiles();
+        unlink_randfiles();
+
+        if (b == 2)
+            tmpfs_cleanup();
+
+        memcpy(results[b], g_phase_result, sizeof(g_phase_result));
+    }
+
+    printf("\nEnd-to-end benchmark: %u files of %u MiB\n",
+           gopt_file_limit, gopt_file_size);
+    printf("%-8s %-7s %10s %10s %9s %9s %9s %9s\n", "backend", "phase",
+           "MiB/s", "tool MiB/s", "tool time", "gen s", "I/O s", "cmp s");
+    for (b = 0; backends[b]; ++b) {
+        memcpy(g_phase_result, results[b], sizeof(g_phase_result));
+        bench_e2e_line(backends[b], DIR_WRITE);
+        bench_e2e_line(backends[b], DIR_READ);
+    }
+    printf("tool MiB/s: throughput limit if I/O took no time, "
+           "tool time: share of wall time spent outside I/O calls.\n");
 }
 
 int main(int argc, char* argv[])
@@ -520,25 +7548,87 @@ int main(int argc, char* argv[])
 
     parse_commandline(argc, argv);
 
-    for (r = 0; r < gopt_repeat; ++r)
+    stats_init(g_stats);
+    if (gopt_stats_shm)
+        stats_shm_create(gopt_stats_shm);
+
+    install_signals();
+
+    numa_setup();
+    io_mode_setup();
+    engine_start();
+
+    if (gopt_bench_e2e) {
+        bench_e2e();
+        stats_phase(PHASE_DONE, 0);
+        return 0;
+    }
+
+    report_setup();
+
+    if (gopt_scrub)
+        scrub_run();
+    else if (gopt_sweep)
+        sweep();
+    else if (gopt_age)
+        age_run();
+    else if (gopt_reread)
+        reread_run();
+    else if (gopt_io_compare)
+        io_mode_compare();
+    else if (gopt_bench_trials)
+        bench_trials();
+    else
     {
-        if (gopt_readonly)
-        {
-            read_randfiles();
-            if (gopt_unlink_after)
-                unlink_randfiles();
-        }
-        else
+        if (gopt_autotune > 0 && gopt_readonly)
+            printf("Auto-tuning needs to write a probe file, "
+                   "skipped with -r.\n");
+        else if (gopt_autotune > 0)
+            autotune();
+
+        for (r = 0; r < gopt_repeat; ++r)
         {
-            unlink_randfiles();
-            write_randfiles();
-            if (!gopt_skip_verify)
+            stats_begin();
+            g_stats->repeat = r;
+            stats_end();
+
+            if (gopt_readonly)
+            {
                 read_randfiles();
-            if (gopt_unlink_after)
+                if (gopt_unlink_after)
+                    unlink_randfiles();
+            }
+            else
+            {
                 unlink_randfiles();
+                write_randfiles();
+                if (!gopt_skip_verify)
+                    read_randfiles();
+                if (gopt_unlink_after)
+                    unlink_randfiles();
+            }
         }
     }
 
+    engine_stop();
+    stats_phase(PHASE_DONE, 0);
+    numa_report();
+
+    if (gopt_json)
+        report_write(gopt_json);
+
+    if (g_write_failed) {
+        printf("Writing failed with an I/O error before the disk was full.\n");
+        return EXIT_FAILURE;
+    }
+
+    if ((gopt_reread || gopt_scrub) &&
+        (g_stats->errors || g_stats->mismatches))
+        return EXIT_FAILURE;
+
+    if (gopt_baseline && baseline_compare())
+        return EXIT_REGRESSION;
+
     return 0;
 }
 
@@ -0,0 +1,62 @@
+#!/bin/sh
+# Fault injection tests of disk-filltest, run by "make check".
+#
+# Each fault kind is injected into three 4 MiB files on the mem backend, and
+# the exit status, the reported file and offset, and the throughput lines are
+# checked. Runs in a few seconds on any Linux box without touching the disk.
+
+DFT=${1:-./disk-filltest}
+failed=0
+
+# check <fault> <expected status> <pattern>...
+check()
+{
+    fault=$1
+    status=$2
+    shift 2
+
+    out=$("$DFT" -s 1 -f 3 -S 4 --backend=mem --fault="$fault" 2>&1)
+    st=$?
+
+    if [ "$st" -ne "$status" ]; then
+        echo "FAIL $fault: exit status $st, expected $status"
+        failed=1
+    fi
+    for pattern in "$@" "fired 1,"; do
+        if ! printf '%s\n' "$out" | grep -q -e "$pattern"; then
+            echo "FAIL $fault: missing output: $pattern"
+            failed=1
+        fi
+    done
+    if [ "$failed" -ne 0 ]; then
+        printf '%s\n' "$out"
+        exit 1
+    fi
+    echo "ok   $fault"
+}
+
+WROTE='^Wrote 4 MiB random data to random-00000000 with [0-9.]* MiB/s'
+READ='^Read 4 MiB random data from random-00000000 with [0-9.]* MiB/s'
+
+check eio-read:1:1m 1 "$WROTE" "$READ" \
+    "Error reading file random-00000001 at offset 1048576: Input/output error"
+check eio-write:1:1m 1 "$WROTE" \
+    "Error writing next file random-00000001: Input/output error" \
+    "Writing failed with an I/O error before the disk was full."
+check short-read:1:1500000 0 "$WROTE" "$READ" \
+    "Successfully verified 3 files"
+check short-write:1:1500000 0 "$WROTE" "$READ" \
+    "Successfully verified 3 files"
+check bitflip:1:1000000 1 "$WROTE" "$READ" \
+    "Mismatch to random sequence in file random-00000001 block 0 at offset 1000000 (file offset 1000000)"
+check zero:1:1m 1 "$WROTE" "$READ" \
+    "Mismatch to random sequence in file random-00000001 block 1 at offset 0 (file offset 1048576)"
+check misplace:1:1m 1 "$WROTE" "$READ" \
+    "Mismatch to random sequence in file random-00000001 block 1 at offset 0 (file offset 1048576)"
+
+# a full disk ends the fill cleanly, the short last file verifies
+check enospc:5m 0 "$WROTE" "$READ" \
+    "Error writing next file random-00000001: No space left on device" \
+    "Successfully verified 2 files"
+
+echo "All fault injection tests passed."